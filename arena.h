@@ -0,0 +1,122 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+#define ARENA_ALIGN     64              // Every take() starts on its own cache line
+#define ARENA_HUGE_PAGE (2u << 20)      // Transparent hugepage size (x86-64 / arm64 with 4K pages)
+
+// One allocation holding all sets, blocks and stream buffers of a hierarchy
+// Callers size it up front (see Cache::storage_bytes) and carve it with take(); nothing is freed until the arena goes.
+// With hugePages a region of at least one hugepage is mmap'ed on a hugepage boundary and advised for THP, so a large
+// tag store needs a handful of TLB entries instead of one per 4K page; smaller regions stay on the heap. Memory is zeroed.
+class Arena {
+private:
+    uint8_t* base = NULL;                   // Start of the region
+    uint8_t* mapping = NULL;                // What mmap returned (NULL if the region is on the heap)
+    size_t mappingSize = 0;                 // Bytes mapped
+    size_t capacity = 0;                    // Usable bytes from base
+    size_t used = 0;                        // Bytes handed out
+    vector<void*> overflow;                 // Extra heap chunks if take() outgrows the capacity
+
+public:
+    bool hugePages = false;                 // Flag to track if the region was advised for hugepages
+
+    Arena(size_t capacity, bool hugePages);
+    ~Arena();
+    void* take(size_t bytes);
+
+    template <class T>
+    T* take_array(size_t count) { return (T*)take(count * sizeof(T)); }
+
+    // Bytes one take() of this size consumes
+    static size_t round(size_t bytes) { return (bytes + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1); }
+};
+
+Arena::Arena(size_t capacity, bool hugePages) : capacity(capacity) {
+    if (capacity == 0) {
+        return;
+    }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // Below one hugepage there is no TLB reach to gain, only the padding of the mapping
+    if (hugePages && (capacity >= ARENA_HUGE_PAGE)) {
+        // Over-map by one hugepage so the region can start on a hugepage boundary
+        size_t huge = (capacity + ARENA_HUGE_PAGE - 1) & ~((size_t)ARENA_HUGE_PAGE - 1);
+        mappingSize = huge + ARENA_HUGE_PAGE;
+        void* p = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            mapping = (uint8_t*)p;
+            base = (uint8_t*)(((uintptr_t)p + ARENA_HUGE_PAGE - 1) & ~((uintptr_t)ARENA_HUGE_PAGE - 1));
+            this->hugePages = (madvise(base, huge, MADV_HUGEPAGE) == 0);
+            if (!this->hugePages) {
+                fprintf(stderr, "Arena: hugepages not available (%s), using regular pages\n", strerror(errno));
+            }
+            return;
+        }
+        fprintf(stderr, "Arena: unable to map %zu bytes (%s), using the heap\n", mappingSize, strerror(errno));
+        mappingSize = 0;
+    }
+#else
+    if (hugePages) {
+        fprintf(stderr, "Arena: hugepages not supported on this platform, using the heap\n");
+    }
+#endif
+
+    base = (uint8_t*)aligned_alloc(ARENA_ALIGN, round(capacity));
+    if (base == NULL) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes for the cache hierarchy.\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+    memset(base, 0, round(capacity));
+}
+
+Arena::~Arena() {
+#ifdef __linux__
+    if (mapping != NULL) {
+        munmap(mapping, mappingSize);
+    }
+#endif
+    if (mapping == NULL) {
+        free(base);
+    }
+    for (uint32_t i = 0; i < overflow.size(); i++) {
+        free(overflow[i]);
+    }
+}
+
+// Hands out the next zeroed, ARENA_ALIGN-aligned piece; past the capacity it falls back to a separate heap chunk
+void* Arena::take(size_t bytes) {
+    bytes = round(bytes);
+    if (bytes == 0) {
+        return NULL;
+    }
+
+    if (used + bytes <= capacity) {
+        void* p = base + used;
+        used += bytes;
+        return p;
+    }
+
+    void* p = aligned_alloc(ARENA_ALIGN, bytes);
+    if (p == NULL) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes for the cache hierarchy.\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+    memset(p, 0, bytes);
+    overflow.push_back(p);
+    return p;
+}
+
+#endif
@@ -1,10 +1,16 @@
 #include <iostream>
 #include <cmath>
+#include <cstring>
 #include <vector>
 #include <algorithm>
 #include "sim.h"
+#include "miss_stream.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "arena.h"
 
 #define WORDWIDTH 32    // Data width
+#define CACHE_STATE_VERSION 1   // Bump whenever save_state() changes what it writes
 
 using namespace std;
 
@@ -19,6 +25,7 @@ private:
     uint32_t blockSize;                     // Number of bytes in a block   
     uint32_t streamBuffers;                 // Number of stream buffers
     uint32_t streamMemoryBlocks;            // Stream memory size
+    uint32_t sectors;                       // Number of sectors per block (1 = unsectored)
 
     // Derived parameters
     uint32_t numBlocks;                     // Number of blocks in a set
@@ -26,21 +33,53 @@ private:
     uint32_t blockOffsetBits;               // Number of offset bits
     uint32_t indexBits;                     // Number of index bits
     uint32_t tagBits;                       // Number of tag bits
+    uint32_t sectorOffsetBits;              // Number of offset bits within a sector (transfer unit)
+    uint32_t allSectors;                    // Mask with one bit per sector
 
     // Access parameters
     char rw = '\0';                         // Flag to track if read or write
     uint32_t addr = 0;                      // Address
 
+    // Storage
+    Arena* arena;                           // Where sets, blocks, buffers and victim entries are carved from
+    Arena* ownArena = NULL;                 // Private arena when none is shared (freed with the cache)
+
     // Sets
     Cache_Set* mySet = NULL;               // Pointer to dynamically allocate sets
+    Cache_Block* blockBase = NULL;          // First block of set 0 (the blocks of all sets are contiguous)
+
+    // Sector masks (only allocated if sectored; unsectored blocks use validBit/dirtyBit)
+    Sector_Masks* blockMasks = NULL;        // Masks of the set blocks, in block order
+    Sector_Masks* victimMasks = NULL;       // Masks of the victim entries
 
     // Prefetch Buffers
     Prefetch_Buffer* mybuffer = NULL;      // Pointer to dynamically allocate buffers
+
+    // Victim Cache
+    uint32_t victimBlocks = 0;              // Number of fully-associative victim entries (0 if not attached)
+    Cache_Block* victimCache = NULL;        // Victim entries; tag holds the full block address
+
+    // Write policy
+    bool writeThrough = false;              // Write hits are sent below (blocks never get dirty)
+    bool writeAllocate = true;              // Write misses fetch and allocate the block
+
+    // Write Buffer
+    uint32_t writeBufferEntries = 0;        // Number of coalescing write buffer entries (0 if not attached)
+    vector<uint32_t> writeBuffer;           // Pending block addresses, oldest first
+
+    // Same-block fast path
+    Cache_Block* lastHit = NULL;            // MRU block of the last access (NULL if the shortcut is not safe)
+    uint32_t lastBlock = 0;                 // Block (sector) address of the last access
     
 
 public:
     // Cache hierarchy parameters
     Cache* nextCache;                       // Pointer to track next level cache (NULL is next level not present)
+    Miss_Stream* missStream = NULL;         // Records requests sent to nextCache (NULL if not recording)
+    Cache* prevCache = NULL;                // Pointer to track upper level cache (used for back-invalidation)
+    inclusion_t inclusion = INCLUSION_NINE; // Inclusion policy between this cache and nextCache/prevCache
+    Self_Profiler* profiler = NULL;         // Charges prefetch unit work to its own phase (NULL if not profiling)
+    bool fastPath = true;                   // Same-block shortcut (the harness turns it off to check it changes nothing)
 
     // Prefetch Buffers
     bool buffer_active;                     // Flag to track if buffer is active or not
@@ -56,37 +95,110 @@ public:
     uint32_t read_prefetch;                 // Number of L2 reads that originated from L1 prefetches
     uint32_t read_prefetch_misses;          // Number of L2 reads that originated from L1 prefetches
     uint32_t mem_traffic;                   // Number of main mem accesses
+    uint32_t victim_hits;                   // Number of misses in the sets served by the victim cache
+    uint32_t back_invalidations;            // Number of blocks dropped because the next level evicted them
+    uint32_t write_throughs;                // Number of writes sent below by write-through / no-write-allocate
+    uint32_t writes_absorbed;               // Number of writes merged into a pending write buffer entry
 
     // Cache Methods
-    Cache(uint32_t cacheSize, uint32_t assoc, uint32_t blockSize, uint32_t streamBuffers, uint32_t streamMemoryBlocks, Cache* nextCache);
+    Cache(uint32_t cacheSize, uint32_t assoc, uint32_t blockSize, uint32_t streamBuffers, uint32_t streamMemoryBlocks, Cache* nextCache, uint32_t sectors = 1, Arena* arena = NULL);
     ~Cache();
+    static size_t storage_bytes(uint32_t cacheSize, uint32_t assoc, uint32_t blockSize, uint32_t streamBuffers, uint32_t streamMemoryBlocks, bool lastLevel, uint32_t victimBlocks = 0, uint32_t sectors = 1);
     void init_cache();
     void cache_read(uint32_t addr);
     void cache_write(uint32_t addr);
+    void next_read(uint32_t addr);
+    void next_write(uint32_t addr);
+    void record_miss(uint32_t addr, bool bufferHit, uint32_t &misses);
+    void write_hit(Cache_Block &block, uint32_t addr);
+    void write_around(uint32_t addr, bool bufferHit);
+    void fill_sector(uint32_t addr, uint32_t index, uint32_t way, bool bufferHit, uint32_t &misses);
+    uint32_t allocate(uint32_t addr, uint32_t bits[], bool bufferHit, bool &fetchedDirty);
+    void evict(uint32_t addr, uint32_t validSectors, uint32_t dirtySectors);
+    void fetch(uint32_t addr, bool bufferHit);
+    void write_below(uint32_t addr);
+    void send_write(uint32_t addr);
+    bool cache_extract(uint32_t addr);
+    void cache_insert(uint32_t addr, bool dirty);
+    uint32_t back_invalidate(uint32_t addr);
+    void invalidate_block(uint32_t index, uint32_t way);
     void get_bits(uint32_t bits[], uint32_t addr);
+    uint32_t sector_bit(uint32_t addr) { return 1u << ((addr >> sectorOffsetBits) & (sectors - 1)); }
+    Sector_Masks* masks(const Cache_Block &block);
+    uint32_t valid_sectors(const Cache_Block &block) { return (sectors == 1) ? block.validBit : masks(block)->validSectors; }
+    uint32_t dirty_sectors(const Cache_Block &block) { return (sectors == 1) ? block.dirtyBit : masks(block)->dirtySectors; }
+    void set_sectors(Cache_Block &block, uint32_t validSectors, uint32_t dirtySectors);
     void update_lru(uint32_t index, uint32_t accessed_block_index);
+    void set_last_block(uint32_t addr, uint32_t index, uint32_t way, bool bufferHit);
     uint32_t find_replacement_lru(uint32_t index);
     void miss_rate_calc();
     void print_block_contents();
     void print_perf_params();
+    void save_state(vector<uint8_t> &state);
+    static uint32_t state_format() { return (CACHE_STATE_VERSION << 16) | (sizeof(Sector_Masks) << 8) | sizeof(Cache_Block); }
+    bool load_state(const vector<uint8_t> &state);
+    void snapshot(Cache_Snapshot &snap);
+    bool holds(uint32_t addr);
+    void resident_blocks(vector<uint32_t> &addrs);
 
     // Buffer Methods
     void new_prefetch(uint32_t addr);
     void sync_prefetch(uint32_t buffer_block, uint32_t buffer_index, uint32_t buffer_shift_index);
     void continue_prefetch(uint32_t buffer_block, uint32_t buffer_index, uint32_t addr);
     bool prefetch_request(uint32_t addr);
+    bool buffer_holds(uint32_t block_addr);
     void update_buffer_lru(uint32_t buffer_index);
     uint32_t find_replacement_buffer_lru();
     void print_buffer();
+
+    // Victim Cache Methods
+    void attach_victim_cache(uint32_t victimBlocks);
+    bool victim_swap(uint32_t addr, uint32_t bits[], uint32_t &way);
+    void victim_update_lru(uint32_t way);
+    uint32_t find_victim_lru();
+    void invalidate_victim(uint32_t way);
+    void print_victim_contents();
+
+    // Write Policy / Buffer Methods
+    void set_write_policy(write_policy_t policy);
+    void attach_write_buffer(uint32_t entries);
+    void drain_write_buffer();
 };
 
 // Constructor (The Man, the Myth, the Legend)
-Cache::Cache(uint32_t cacheSize, uint32_t assoc, uint32_t blockSize, uint32_t streamBuffers, uint32_t streamMemoryBlocks, Cache* nextCache)
-    : cacheSize(cacheSize), assoc(assoc), blockSize(blockSize), streamBuffers(streamBuffers), streamMemoryBlocks(streamMemoryBlocks), nextCache(nextCache)
+// Without a shared arena the cache sizes and owns one for itself
+Cache::Cache(uint32_t cacheSize, uint32_t assoc, uint32_t blockSize, uint32_t streamBuffers, uint32_t streamMemoryBlocks, Cache* nextCache, uint32_t sectors, Arena* arena)
+    : cacheSize(cacheSize), assoc(assoc), blockSize(blockSize), streamBuffers(streamBuffers), streamMemoryBlocks(streamMemoryBlocks), sectors(sectors), arena(arena), nextCache(nextCache)
 {
+    if ((this->arena == NULL) && (cacheSize > 0)) {
+        ownArena = new Arena(storage_bytes(cacheSize, assoc, blockSize, streamBuffers, streamMemoryBlocks, nextCache == NULL, 0, sectors), false);
+        this->arena = ownArena;
+    }
     init_cache();
 }
 
+// Arena bytes init_cache() and attach_victim_cache() take for this geometry (0 if the level is not present)
+// Must mirror the take() calls below one for one
+size_t Cache::storage_bytes(uint32_t cacheSize, uint32_t assoc, uint32_t blockSize, uint32_t streamBuffers, uint32_t streamMemoryBlocks, bool lastLevel, uint32_t victimBlocks, uint32_t sectors) {
+    if (cacheSize == 0) {
+        return 0;
+    }
+
+    size_t sets = cacheSize / (assoc * blockSize);
+    size_t bytes = Arena::round(sets * sizeof(Cache_Set)) + Arena::round(sets * assoc * sizeof(Cache_Block));
+    if (sectors > 1) {
+        bytes += Arena::round(sets * assoc * sizeof(Sector_Masks));
+    }
+    if ((streamBuffers > 0) && lastLevel) {
+        bytes += Arena::round(streamBuffers * sizeof(Prefetch_Buffer)) + Arena::round((size_t)streamBuffers * streamMemoryBlocks * sizeof(Prefetch_Block));
+    }
+    bytes += Arena::round(victimBlocks * sizeof(Cache_Block));
+    if (sectors > 1) {
+        bytes += Arena::round(victimBlocks * sizeof(Sector_Masks));
+    }
+    return bytes;
+}
+
 // Initialization function to set context
 void Cache::init_cache() {
     
@@ -97,6 +209,8 @@ void Cache::init_cache() {
         blockOffsetBits = 0;
         indexBits       = 0;
         tagBits         = 0;
+        sectorOffsetBits = 0;
+        allSectors      = 0;
         miss_rate       = 0;
 
         reads           = 0;
@@ -111,6 +225,10 @@ void Cache::init_cache() {
         read_prefetch   = 0;
         read_prefetch_misses = 0;
         mem_traffic     = 0;
+        victim_hits     = 0;
+        back_invalidations = 0;
+        write_throughs  = 0;
+        writes_absorbed = 0;
     }
     // If initialized
     else {
@@ -119,6 +237,8 @@ void Cache::init_cache() {
         blockOffsetBits = log2(blockSize);
         indexBits = log2(numSets);
         tagBits = WORDWIDTH - blockOffsetBits - indexBits;
+        sectorOffsetBits = blockOffsetBits - log2(sectors);
+        allSectors = (sectors == 32) ? 0xffffffff : ((1u << sectors) - 1);
         miss_rate = 0;
 
         reads           = 0;
@@ -133,24 +253,33 @@ void Cache::init_cache() {
         read_prefetch   = 0;
         read_prefetch_misses = 0;
         mem_traffic     = 0;
-
-        // Cache ,emory allocation
-        mySet = new Cache_Set[numSets];
+        victim_hits     = 0;
+        back_invalidations = 0;
+        write_throughs  = 0;
+        writes_absorbed = 0;
+
+        // Cache ,emory allocation (all blocks are contiguous, set i starts at block i * assoc)
+        mySet = arena->take_array<Cache_Set>(numSets);
+        blockBase = arena->take_array<Cache_Block>((size_t)numSets * assoc);
         for (uint32_t i = 0; i < numSets; i++) {
-            mySet[i].blocks = new Cache_Block[assoc];
+            mySet[i].blocks = blockBase + (size_t)i * assoc;
             for (uint32_t j = 0; j < assoc; j++) {
-                mySet[i].blocks[j] = { false, false, j, 0, 0 }; // Initialize block properties
+                mySet[i].blocks[j] = { 0, (uint16_t)j, false, false }; // Initialize block properties
             }
         }
+        if (sectors > 1) {
+            blockMasks = arena->take_array<Sector_Masks>((size_t)numSets * assoc); // Zeroed: no sector valid or dirty
+        }
 
         // If Prefetch is active and there is no next level cache (directly main memory)
         if ((streamBuffers > 0) && (nextCache == NULL)) {
             buffer_active = true;
 
             // Prefetch buffer memory allocation
-            mybuffer = new Prefetch_Buffer[streamBuffers];
+            mybuffer = arena->take_array<Prefetch_Buffer>(streamBuffers);
+            Prefetch_Block* prefetch_blocks = arena->take_array<Prefetch_Block>((size_t)streamBuffers * streamMemoryBlocks);
             for (uint32_t i = 0; i < streamBuffers; i++) {
-                mybuffer[i].prefetch_blocks = new Prefetch_Block[streamMemoryBlocks];
+                mybuffer[i].prefetch_blocks = prefetch_blocks + (size_t)i * streamMemoryBlocks;
                 mybuffer[i].valid_prefetch = false;
                 mybuffer[i].buffer_lru = i;
                 for (uint32_t j = 0; j < streamMemoryBlocks; j++) {
@@ -168,8 +297,16 @@ void Cache::cache_read(uint32_t addr) {
     // bits[1] = set index
     // bits[2] = tag
     bool bufferHit = false;
+    bool fetchedDirty = false;
+    uint32_t way;
 
     reads++;
+
+    // Same-block fast path; repeat hit to the MRU block (sector) leaves LRU and buffers untouched
+    if ((lastHit != NULL) && ((addr >> sectorOffsetBits) == lastBlock)) {
+        return;
+    }
+
     get_bits(bits, addr);
 
     // Search the buffer for block
@@ -182,103 +319,315 @@ void Cache::cache_read(uint32_t addr) {
         if (mySet[bits[1]].blocks[i].validBit && (bits[2] == mySet[bits[1]].blocks[i].tag)) {
             // Read Hit :)
             update_lru(bits[1], i);
+            // Sector Miss :| (tag present, sector not)
+            if (!(valid_sectors(mySet[bits[1]].blocks[i]) & sector_bit(addr))) {
+                fill_sector(addr, bits[1], i, bufferHit, read_misses);
+            }
+            set_last_block(addr, bits[1], i, bufferHit);
             return;
         }
     }
 
+    // Search the victim cache (block is swapped back into the set)
+    if (victim_swap(addr, bits, way)) {
+        if (!(valid_sectors(mySet[bits[1]].blocks[way]) & sector_bit(addr))) {
+            fill_sector(addr, bits[1], way, bufferHit, read_misses);
+        }
+        set_last_block(addr, bits[1], way, bufferHit);
+        return;
+    }
+
     // Read Miss :(
+    record_miss(addr, bufferHit, read_misses);
+
+    // Evict, fetch and update replaced block
+    way = allocate(addr, bits, bufferHit, fetchedDirty);
+    Cache_Block &block = mySet[bits[1]].blocks[way];
+    block.validBit = true;
+    block.dirtyBit = fetchedDirty;
+    set_sectors(block, sector_bit(addr), fetchedDirty ? sector_bit(addr) : 0);
+    block.tag = bits[2];
+    set_last_block(addr, bits[1], way, bufferHit);
+}
+
+// Cache write function; handles writes (another dumb comment lol)
+void Cache::cache_write(uint32_t addr) {
+    uint32_t bits[3];
+    // bits[0] = block offset
+    // bits[1] = set index
+    // bits[2] = tag
+    bool bufferHit = false;
+    bool fetchedDirty = false;
+    uint32_t way;
+
+    writes++;
+
+    // Same-block fast path; repeat hit to the MRU block (sector) only dirties it (or writes it through)
+    if ((lastHit != NULL) && ((addr >> sectorOffsetBits) == lastBlock)) {
+        write_hit(*lastHit, addr);
+        return;
+    }
+
+    get_bits(bits, addr);
+
+    // Search the buffer for block
+    if (buffer_active) {
+        bufferHit = prefetch_request(addr);
+    }
+
+    // Search the set for tag
+    for (uint32_t i = 0; i < assoc; i++) {
+        if (mySet[bits[1]].blocks[i].validBit && (bits[2] == mySet[bits[1]].blocks[i].tag)) {
+            // Sector Miss :| (tag present, sector not)
+            if (!(valid_sectors(mySet[bits[1]].blocks[i]) & sector_bit(addr))) {
+                if (!writeAllocate) {
+                    write_around(addr, bufferHit);
+                    return;
+                }
+                fill_sector(addr, bits[1], i, bufferHit, write_misses);
+            }
+            // Write Hit :)
+            update_lru(bits[1], i);
+            write_hit(mySet[bits[1]].blocks[i], addr);
+            set_last_block(addr, bits[1], i, bufferHit);
+            return;
+        }
+    }
+
+    // Search the victim cache (block is swapped back into the set)
+    if (victim_swap(addr, bits, way)) {
+        if (!(valid_sectors(mySet[bits[1]].blocks[way]) & sector_bit(addr))) {
+            if (!writeAllocate) {
+                write_around(addr, bufferHit);
+                return;
+            }
+            fill_sector(addr, bits[1], way, bufferHit, write_misses);
+        }
+        write_hit(mySet[bits[1]].blocks[way], addr);
+        set_last_block(addr, bits[1], way, bufferHit);
+        return;
+    }
+
+    // No-write-allocate: the write goes around this cache
+    if (!writeAllocate) {
+        write_around(addr, bufferHit);
+        return;
+    }
+
+    // Write Miss :(
+    record_miss(addr, bufferHit, write_misses);
+
+    // Evict, fetch and update replaced block
+    way = allocate(addr, bits, bufferHit, fetchedDirty);
+    Cache_Block &block = mySet[bits[1]].blocks[way];
+    block.validBit = true;
+    block.dirtyBit = fetchedDirty;
+    set_sectors(block, sector_bit(addr), fetchedDirty ? sector_bit(addr) : 0);
+    block.tag = bits[2];
+    write_hit(block, addr);
+    set_last_block(addr, bits[1], way, bufferHit);
+}
+
+// Counts a demand miss; with an active stream buffer, only buffer misses count (and start a new stream)
+void Cache::record_miss(uint32_t addr, bool bufferHit, uint32_t &misses) {
     if (buffer_active) {
         if(!bufferHit) {
-            read_misses++;
+            misses++;
             new_prefetch(addr);
         }
     }
     else {
-        read_misses++;
+        misses++;
     }
-    
-    // Replement block index
-    uint32_t victim_index = find_replacement_lru(bits[1]);
+}
 
-    // If LRU block is clean
-    if(!mySet[bits[1]].blocks[victim_index].dirtyBit) {
-        // If prefetch is not active
-        if (!buffer_active) {
-            // If next level exists
-            if(nextCache != NULL) {
-                nextCache->cache_read(addr);
-            }
-            // If only L1 exists
-            else {
-                mem_traffic++;
-            }
-        }
-        // If prefetch is active
-        else {
-            // If prefetch miss
-            if(!bufferHit) {
-                mem_traffic++;
-            }
-        }
+// Applies a write to a resident sector: write-back dirties it, write-through sends it below
+void Cache::write_hit(Cache_Block &block, uint32_t addr) {
+    if (writeThrough) {
+        write_throughs++;
+        write_below(addr);
+    }
+    else {
+        block.dirtyBit = true; // Set dirty bit on write
+        set_sectors(block, valid_sectors(block), dirty_sectors(block) | sector_bit(addr));
+    }
+}
 
-        // Update LRU
-        update_lru(bits[1], victim_index);
+// No-write-allocate miss: counted as a write miss and sent below without touching the sets
+void Cache::write_around(uint32_t addr, bool bufferHit) {
+    record_miss(addr, bufferHit, write_misses);
+    write_throughs++;
+    write_below(addr);
+    lastHit = NULL;
+}
 
-        // Update replaced block
-        mySet[bits[1]].blocks[victim_index].validBit = true;
-        mySet[bits[1]].blocks[victim_index].tag = bits[2];
-        mySet[bits[1]].blocks[victim_index].block_data++;
+// Sector masks of a set block or victim entry (sectored caches only)
+Sector_Masks* Cache::masks(const Cache_Block &block) {
+    if ((victimCache != NULL) && (&block >= victimCache) && (&block < victimCache + victimBlocks)) {
+        return &victimMasks[&block - victimCache];
+    }
+    return &blockMasks[&block - blockBase];
+}
 
-        return;
+// Updates the sector masks; nothing to store if unsectored (validBit/dirtyBit carry the state)
+void Cache::set_sectors(Cache_Block &block, uint32_t validSectors, uint32_t dirtySectors) {
+    if (sectors > 1) {
+        Sector_Masks* m = masks(block);
+        m->validSectors = validSectors;
+        m->dirtySectors = dirtySectors;
     }
+}
+
+// Fetches the missing sector of a resident block (no eviction needed)
+void Cache::fill_sector(uint32_t addr, uint32_t index, uint32_t way, bool bufferHit, uint32_t &misses) {
+    record_miss(addr, bufferHit, misses);
+    fetch(addr, bufferHit);
+    Cache_Block &block = mySet[index].blocks[way];
+    set_sectors(block, valid_sectors(block) | sector_bit(addr), dirty_sectors(block));
+}
 
-    // If LRU block is dirty
+// Makes room for a missing block: picks the LRU way, sends the old block out and brings the new one in
+// NINE/inclusive write the dirty victim back before the fetch (same order as before the modes existed)
+// Exclusive pulls the block out of the next level first, so parking the victim there cannot evict it
+// Returns the way; fetchedDirty is set if the block came back dirty from an exclusive next level
+uint32_t Cache::allocate(uint32_t addr, uint32_t bits[], bool bufferHit, bool &fetchedDirty) {
+    uint32_t victim_index = find_replacement_lru(bits[1]);
+    Cache_Block &victim = mySet[bits[1]].blocks[victim_index];
+    uint32_t victim_addr = (victim.tag << (indexBits + blockOffsetBits)) + (bits[1] << blockOffsetBits);
+    bool victim_valid = victim.validBit;
+    uint32_t victim_valid_sectors = valid_sectors(victim);
+    uint32_t victim_dirty_sectors = dirty_sectors(victim);
+
+    // Vacate the slot first so a back-invalidation triggered by the fetch cannot see the old block
+    victim.validBit = false;
+    victim.dirtyBit = false;
+    set_sectors(victim, 0, 0);
+
+    fetchedDirty = false;
+    if ((inclusion == INCLUSION_EXCLUSIVE) && (nextCache != NULL)) {
+        fetchedDirty = nextCache->cache_extract(addr);
+        if (victim_valid) {
+            evict(victim_addr, victim_valid_sectors, victim_dirty_sectors);
+        }
+    }
     else {
-        writebacks++;
-        // If prefetch is not active
-        if (!buffer_active) {
-            // If next level exists
-            if(nextCache != NULL) {
-                uint32_t dirty_addr = (mySet[bits[1]].blocks[victim_index].tag << (indexBits + blockOffsetBits)) + (bits[1] << blockOffsetBits);
-                nextCache->cache_write(dirty_addr);
-                nextCache->cache_read(addr);
-            }
-            else{
-                mem_traffic++;          // write to memory (writeback)
-                mem_traffic++;          // read from memory (fetch new data)
-            }
+        if (victim_valid) {
+            evict(victim_addr, victim_valid_sectors, victim_dirty_sectors);
         }
-        // If prefetch is active
-        else {
-            mem_traffic++;
-            // If prefetch miss
-            if(!bufferHit) {
-                mem_traffic++;
-            }
+        fetch(addr, bufferHit);
+    }
+
+    // Update LRU
+    update_lru(bits[1], victim_index);
+    return victim_index;
+}
+
+// Handles a block leaving the sets; parks it in the victim cache if there is one
+// Whatever finally leaves this level is written back (each dirty sector), or handed to an exclusive next level (always)
+void Cache::evict(uint32_t addr, uint32_t validSectors, uint32_t dirtySectors) {
+    if (victimBlocks > 0) {
+        uint32_t i = find_victim_lru();
+        Cache_Block old = victimCache[i];
+        uint32_t old_dirty_sectors = dirty_sectors(victimCache[i]);
+
+        victimCache[i].validBit = true;
+        victimCache[i].dirtyBit = (dirtySectors != 0);
+        set_sectors(victimCache[i], validSectors, dirtySectors);
+        victimCache[i].tag = addr >> blockOffsetBits;
+        victim_update_lru(i);
+
+        if (!old.validBit) {
+            return;
         }
+        addr = old.tag << blockOffsetBits;
+        dirtySectors = old_dirty_sectors;
+    }
 
-        // Update LRU
-        update_lru(bits[1], victim_index);
+    // Inclusive: the upper level must drop its copy, and its data may be newer than ours
+    if ((inclusion == INCLUSION_INCLUSIVE) && (prevCache != NULL)) {
+        dirtySectors |= prevCache->back_invalidate(addr);
+    }
 
-        // Update replaced block
-        mySet[bits[1]].blocks[victim_index].validBit = true;
-        mySet[bits[1]].blocks[victim_index].dirtyBit = false;
-        mySet[bits[1]].blocks[victim_index].tag = bits[2];
-        mySet[bits[1]].blocks[victim_index].block_data++;
+    writebacks += __builtin_popcount(dirtySectors);
 
+    // Exclusive: next level acts as the victim store, clean blocks included
+    if ((inclusion == INCLUSION_EXCLUSIVE) && (nextCache != NULL)) {
+        nextCache->cache_insert(addr, dirtySectors != 0);
         return;
-    }    
+    }
+    for (uint32_t s = 0; dirtySectors != 0; s++, dirtySectors >>= 1) {
+        if (dirtySectors & 1) {
+            write_below(addr + (s << sectorOffsetBits));
+        }
+    }
 }
 
-// Cache write function; handles writes (another dumb comment lol)
-void Cache::cache_write(uint32_t addr) {
+// Brings a block (sector) in from below (nothing to do if the stream buffer already had it)
+void Cache::fetch(uint32_t addr, bool bufferHit) {
+    if (bufferHit) {
+        return;
+    }
+
+    // A pending write to the same block must land before the read
+    uint32_t unit_addr = addr >> sectorOffsetBits;
+    for (uint32_t i = 0; i < writeBuffer.size(); i++) {
+        if (writeBuffer[i] == unit_addr) {
+            writeBuffer.erase(writeBuffer.begin() + i);
+            send_write(addr);
+            break;
+        }
+    }
+
+    if (nextCache != NULL) {
+        next_read(addr);
+    }
+    else {
+        mem_traffic++;              // read from memory (fetch new data)
+    }
+}
+
+// Sends a write (writeback, write-through or write-around) below through the write buffer, if any
+// A write to a block (sector) that is already pending is merged into that entry; a full buffer drains its oldest entry
+void Cache::write_below(uint32_t addr) {
+    if (writeBufferEntries == 0) {
+        send_write(addr);
+        return;
+    }
+
+    uint32_t unit_addr = addr >> sectorOffsetBits;
+    for (uint32_t i = 0; i < writeBuffer.size(); i++) {
+        if (writeBuffer[i] == unit_addr) {
+            writes_absorbed++;
+            return;
+        }
+    }
+
+    if (writeBuffer.size() == writeBufferEntries) {
+        send_write(writeBuffer.front() << sectorOffsetBits);
+        writeBuffer.erase(writeBuffer.begin());
+    }
+    writeBuffer.push_back(unit_addr);
+}
+
+// Delivers a write to the next level or memory
+void Cache::send_write(uint32_t addr) {
+    if (nextCache != NULL) {
+        next_write(addr);
+    }
+    else {
+        mem_traffic++;              // write to memory
+    }
+}
+
+// Exclusive read from the upper level; a hit hands the block over and removes it from this level
+// Misses are fetched from below but not allocated here. Returns the dirty state of the handed-over block
+// (exclusion is only supported for unsectored caches, so whole blocks move)
+bool Cache::cache_extract(uint32_t addr) {
     uint32_t bits[3];
-    // bits[0] = block offset
-    // bits[1] = set index
-    // bits[2] = tag
     bool bufferHit = false;
+    bool dirty;
 
-    writes++;
+    reads++;
     get_bits(bits, addr);
 
     // Search the buffer for block
@@ -289,93 +638,232 @@ void Cache::cache_write(uint32_t addr) {
     // Search the set for tag
     for (uint32_t i = 0; i < assoc; i++) {
         if (mySet[bits[1]].blocks[i].validBit && (bits[2] == mySet[bits[1]].blocks[i].tag)) {
-            // Write Hit :)
-            mySet[bits[1]].blocks[i].dirtyBit = true; // Set dirty bit on write
-            mySet[bits[1]].blocks[i].block_data++;
+            dirty = mySet[bits[1]].blocks[i].dirtyBit;
+            invalidate_block(bits[1], i);
+            return dirty;
+        }
+    }
+
+    // Search the victim cache
+    uint32_t block_addr = addr >> blockOffsetBits;
+    for (uint32_t i = 0; i < victimBlocks; i++) {
+        if (victimCache[i].validBit && (victimCache[i].tag == block_addr)) {
+            victim_hits++;
+            dirty = victimCache[i].dirtyBit;
+            invalidate_victim(i);
+            return dirty;
+        }
+    }
+
+    // Read Miss :(
+    record_miss(addr, bufferHit, read_misses);
+    fetch(addr, bufferHit);
+    return false;
+}
+
+// Exclusive victim insert from the upper level (clean or dirty); no fetch is needed since the data comes along
+void Cache::cache_insert(uint32_t addr, bool dirty) {
+    uint32_t bits[3];
+
+    writes++;
+    get_bits(bits, addr);
+    lastHit = NULL;
+
+    // Already here (only possible if exclusion was broken by an earlier mode); just merge
+    for (uint32_t i = 0; i < assoc; i++) {
+        if (mySet[bits[1]].blocks[i].validBit && (bits[2] == mySet[bits[1]].blocks[i].tag)) {
+            Cache_Block &block = mySet[bits[1]].blocks[i];
+            block.dirtyBit |= dirty;
+            set_sectors(block, valid_sectors(block), dirty_sectors(block) | (dirty ? allSectors : 0));
             update_lru(bits[1], i);
             return;
         }
     }
 
-    // Write Miss :(
-    if (buffer_active) {
-        if(!bufferHit) {
-            write_misses++;
-            new_prefetch(addr);
+    uint32_t victim_index = find_replacement_lru(bits[1]);
+    Cache_Block &victim = mySet[bits[1]].blocks[victim_index];
+    if (victim.validBit) {
+        evict((victim.tag << (indexBits + blockOffsetBits)) + (bits[1] << blockOffsetBits), valid_sectors(victim), dirty_sectors(victim));
+    }
+
+    update_lru(bits[1], victim_index);
+    victim.validBit = true;
+    victim.dirtyBit = dirty;
+    set_sectors(victim, allSectors, dirty ? allSectors : 0);
+    victim.tag = bits[2];
+}
+
+// Inclusive back-invalidation from the next level; returns the dirty sectors of the dropped copy
+uint32_t Cache::back_invalidate(uint32_t addr) {
+    uint32_t bits[3];
+    uint32_t dirtySectors;
+
+    get_bits(bits, addr);
+
+    for (uint32_t i = 0; i < assoc; i++) {
+        if (mySet[bits[1]].blocks[i].validBit && (bits[2] == mySet[bits[1]].blocks[i].tag)) {
+            back_invalidations++;
+            dirtySectors = dirty_sectors(mySet[bits[1]].blocks[i]);
+            invalidate_block(bits[1], i);
+            return dirtySectors;
         }
     }
-    else {
-        write_misses++;
+
+    uint32_t block_addr = addr >> blockOffsetBits;
+    for (uint32_t i = 0; i < victimBlocks; i++) {
+        if (victimCache[i].validBit && (victimCache[i].tag == block_addr)) {
+            back_invalidations++;
+            dirtySectors = dirty_sectors(victimCache[i]);
+            invalidate_victim(i);
+            return dirtySectors;
+        }
     }
-    
-    // Replement block index
-    uint32_t victim_index = find_replacement_lru(bits[1]);
 
-    // If LRU block is clean
-    if(!mySet[bits[1]].blocks[victim_index].dirtyBit) {
-        // If prefetch is not active
-        if (!buffer_active) {
-            // If next level exists
-            if(nextCache != NULL) {
-                nextCache->cache_read(addr);
+    return 0;
+}
+
+// Drops a block and makes it LRU so it is the next one replaced
+void Cache::invalidate_block(uint32_t index, uint32_t way) {
+    Cache_Block* blocks = mySet[index].blocks;
+    for (uint32_t j = 0; j < assoc; j++) {
+        if (blocks[j].lru_counter > blocks[way].lru_counter) {
+            blocks[j].lru_counter--;
+        }
+    }
+    blocks[way].lru_counter = assoc - 1;
+    blocks[way].validBit = false;
+    blocks[way].dirtyBit = false;
+    set_sectors(blocks[way], 0, 0);
+
+    lastHit = NULL;
+}
+
+// Victim cache lookup on a set miss
+// On a hit the block moves into the set and the set's LRU block takes its place in the victim cache
+bool Cache::victim_swap(uint32_t addr, uint32_t bits[], uint32_t &way) {
+    uint32_t block_addr = addr >> blockOffsetBits;
+
+    for (uint32_t i = 0; i < victimBlocks; i++) {
+        if (victimCache[i].validBit && (victimCache[i].tag == block_addr)) {
+            // Victim Hit :)
+            victim_hits++;
+            Cache_Block entry = victimCache[i];
+            uint32_t entry_valid_sectors = valid_sectors(victimCache[i]);
+            uint32_t entry_dirty_sectors = dirty_sectors(victimCache[i]);
+
+            way = find_replacement_lru(bits[1]);
+            Cache_Block &slot = mySet[bits[1]].blocks[way];
+            if (slot.validBit) {
+                victimCache[i].tag = (slot.tag << indexBits) + bits[1];
+                victimCache[i].dirtyBit = slot.dirtyBit;
+                set_sectors(victimCache[i], valid_sectors(slot), dirty_sectors(slot));
+                victim_update_lru(i);
             }
-            // If only L1 exists
             else {
-                mem_traffic++;
-            }
-        }
-        // If prefetch is active
-        else {
-            // If prefetch miss
-            if(!bufferHit) {
-                mem_traffic++;
+                invalidate_victim(i);
             }
+
+            update_lru(bits[1], way);
+            slot.validBit = true;
+            slot.dirtyBit = entry.dirtyBit;
+            set_sectors(slot, entry_valid_sectors, entry_dirty_sectors);
+            slot.tag = bits[2];
+            return true;
         }
+    }
 
-        // Update LRU
-        update_lru(bits[1], victim_index);
+    return false;
+}
 
-        // Update replaced block
-        mySet[bits[1]].blocks[victim_index].validBit = true;
-        mySet[bits[1]].blocks[victim_index].dirtyBit = true;
-        mySet[bits[1]].blocks[victim_index].tag = bits[2];
-        mySet[bits[1]].blocks[victim_index].block_data++;
+// Attaches a small fully-associative victim cache that catches blocks evicted from the sets
+// Entries come from the arena, so it is attached once, right after construction
+void Cache::attach_victim_cache(uint32_t victimBlocks) {
+    victimCache = NULL;
+    this->victimBlocks = (cacheSize > 0) ? victimBlocks : 0;
+    if (this->victimBlocks == 0) {
         return;
     }
 
-    // If LRU block is dirty
-    else {
-        writebacks++;
-        // If prefetch is not active
-        if (!buffer_active) {
-            if(nextCache != NULL) {
-                uint32_t dirty_addr = (mySet[bits[1]].blocks[victim_index].tag << (indexBits + blockOffsetBits)) + (bits[1] << blockOffsetBits);
-                nextCache->cache_write(dirty_addr);
-                nextCache->cache_read(addr);
-            }
-            else{
-                mem_traffic++;          // write to memory (writeback)
-                mem_traffic++;          // read from memory (fetch new data)
-            }
+    victimCache = arena->take_array<Cache_Block>(this->victimBlocks);
+    for (uint32_t j = 0; j < this->victimBlocks; j++) {
+        victimCache[j] = { 0, (uint16_t)j, false, false };
+    }
+    if (sectors > 1) {
+        victimMasks = arena->take_array<Sector_Masks>(this->victimBlocks);
+    }
+}
+
+// Updates the LRU, but for the victim cache
+void Cache::victim_update_lru(uint32_t way) {
+    for (uint32_t j = 0; j < victimBlocks; j++) {
+        if (victimCache[j].lru_counter < victimCache[way].lru_counter) {
+            victimCache[j].lru_counter++;
         }
-        // If prefetch is active
-        else {
-            mem_traffic++;
-            // If prefetch miss
-            if(!bufferHit) {
-                mem_traffic++;
-            }
+    }
+    victimCache[way].lru_counter = 0;
+}
+
+// Returns index of the victim cache entry to replace
+uint32_t Cache::find_victim_lru() {
+    uint32_t replacementIndex = 0;
+
+    for (uint32_t j = 0; j < victimBlocks; j++) {
+        if (victimCache[j].lru_counter > victimCache[replacementIndex].lru_counter) {
+            replacementIndex = j;
         }
-        // Update LRU
-        update_lru(bits[1], victim_index);
+    }
 
-        // Update replaced block
-        mySet[bits[1]].blocks[victim_index].validBit = true;
-        mySet[bits[1]].blocks[victim_index].validBit = true;
-        mySet[bits[1]].blocks[victim_index].tag = bits[2];
-        mySet[bits[1]].blocks[victim_index].block_data++;
-        return;
+    return replacementIndex;
+}
+
+// Drops a victim cache entry and makes it LRU
+void Cache::invalidate_victim(uint32_t way) {
+    for (uint32_t j = 0; j < victimBlocks; j++) {
+        if (victimCache[j].lru_counter > victimCache[way].lru_counter) {
+            victimCache[j].lru_counter--;
+        }
     }
+    victimCache[way].lru_counter = victimBlocks - 1;
+    victimCache[way].validBit = false;
+    victimCache[way].dirtyBit = false;
+    set_sectors(victimCache[way], 0, 0);
+}
+
+// Selects the write hit / write miss policy
+void Cache::set_write_policy(write_policy_t policy) {
+    writeThrough  = (policy == WRITE_WT) || (policy == WRITE_AROUND);
+    writeAllocate = (policy == WRITE_WBWA) || (policy == WRITE_WT);
+}
+
+// Attaches a coalescing write buffer between this cache and the level below
+void Cache::attach_write_buffer(uint32_t entries) {
+    writeBufferEntries = entries;
+    writeBuffer.clear();
+    writeBuffer.reserve(entries);
+}
+
+// Sends every pending write below, oldest first (end of simulation)
+void Cache::drain_write_buffer() {
+    for (uint32_t i = 0; i < writeBuffer.size(); i++) {
+        send_write(writeBuffer[i] << sectorOffsetBits);
+    }
+    writeBuffer.clear();
+}
+
+// Forwards a read to the next level (and records it if a miss stream is attached)
+void Cache::next_read(uint32_t addr) {
+    if (missStream != NULL) {
+        missStream->record('r', addr);
+    }
+    nextCache->cache_read(addr);
+}
+
+// Forwards a write to the next level (and records it if a miss stream is attached)
+void Cache::next_write(uint32_t addr) {
+    if (missStream != NULL) {
+        missStream->record('w', addr);
+    }
+    nextCache->cache_write(addr);
 }
 
 // *bits[] overflow might cause a issue, to fix later if I get time* -> unfixed :( no time
@@ -404,6 +892,18 @@ void Cache::update_lru(uint32_t index, uint32_t accessed_block_index) {
     mySet[index].blocks[accessed_block_index].lru_counter = 0; // Reset for the recently accessed block
 }
 
+// Remembers the block just accessed for the same-block fast path
+// After a buffer hit, another buffer may still hold the block and would hit again, so only arm the shortcut if none does
+void Cache::set_last_block(uint32_t addr, uint32_t index, uint32_t way, bool bufferHit) {
+    lastBlock = addr >> sectorOffsetBits;
+    if (!fastPath || (bufferHit && buffer_holds(lastBlock))) {
+        lastHit = NULL;
+    }
+    else {
+        lastHit = &mySet[index].blocks[way];
+    }
+}
+
 // Returns index of block to be evicted
 // First checks for invalid block, if all valid then returns MRU
 uint32_t Cache::find_replacement_lru(uint32_t index) {
@@ -429,9 +929,10 @@ uint32_t Cache::find_replacement_lru(uint32_t index) {
 // Function for a fresh prefetch
 // Takes an address, extracts block info, and prefetches from block+1 to buffer size
 void Cache::new_prefetch(uint32_t addr) {
+    Sampled_Scope scope(profiler, PHASE_PREFETCH);
     uint32_t buffer_index = find_replacement_buffer_lru();
 
-    uint32_t block_to_replace = (addr >> blockOffsetBits) + 1; // Start prefetching from next block
+    uint32_t block_to_replace = (addr >> sectorOffsetBits) + 1; // Start prefetching from next block (sector if sectored)
 
     // Loop and fill next memory blocks
     for (uint32_t j = 0; j < streamMemoryBlocks; j++) {
@@ -490,7 +991,8 @@ void Cache::continue_prefetch(uint32_t buffer_block, uint32_t buffer_index, uint
 // If hit, update LRU and sync the buffer
 // If miss... well it's a miss
 bool Cache::prefetch_request(uint32_t addr) {
-    uint32_t block_addr = addr >> blockOffsetBits;
+    Sampled_Scope scope(profiler, PHASE_PREFETCH);
+    uint32_t block_addr = addr >> sectorOffsetBits;
 
     // Create a vector to pair LRU values with buffer indices
     vector<pair<uint32_t, uint32_t>> lru_list;
@@ -521,6 +1023,22 @@ bool Cache::prefetch_request(uint32_t addr) {
     return false;
 }
 
+// Checks if any valid buffer holds the block (no LRU or prefetch side effects)
+bool Cache::buffer_holds(uint32_t block_addr) {
+    Sampled_Scope scope(profiler, PHASE_PREFETCH);
+    for (uint32_t i = 0; i < streamBuffers; i++) {
+        if (!mybuffer[i].valid_prefetch) {
+            continue;
+        }
+        for (uint32_t j = 0; j < streamMemoryBlocks; j++) {
+            if (mybuffer[i].prefetch_blocks[j].buffer_block == block_addr) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 // Updates the LRU, but for buffers
 void Cache::update_buffer_lru(uint32_t buffer_index) {
     for (uint32_t j = 0; j < streamBuffers; j++) {
@@ -574,6 +1092,33 @@ void Cache::print_buffer() {
     cout << endl;
 }
 
+// Prints victim cache contents, MRU first (tags are block addresses)
+void Cache::print_victim_contents() {
+    vector<pair<uint32_t, Cache_Block>> temp;
+    for (uint32_t j = 0; j < victimBlocks; j++) {
+        temp.push_back({victimCache[j].lru_counter, victimCache[j]});
+    }
+
+    sort(temp.begin(), temp.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+
+    cout << "victim:\t";
+    for (const auto& temp : temp) {
+        const Cache_Block& block = temp.second;
+        if (!block.validBit) {
+            continue;
+        }
+        cout << hex << block.tag << " ";
+        if (block.dirtyBit == 1) {
+            cout << "D ";
+        }
+        else
+            cout << "  ";
+    }
+    cout << endl << endl;
+}
+
 // Calculates Miss Rate (Why did I create it?)
 void Cache::miss_rate_calc() {
 	if((reads + writes) > 0){
@@ -600,11 +1145,12 @@ void Cache::print_block_contents() {
         });
 
         // Print the blocks in LRU order
+        // Invalid ways print as an empty way (tag 0, clean), whether never filled or invalidated by back-invalidation/exclusion
         cout << "set\t" << dec << i << ":\t";
         for (const auto& temp : temp) {
             const Cache_Block& block = temp.second;
-            cout << hex << block.tag << " ";
-            if (block.dirtyBit == 1) {
+            cout << hex << (block.validBit ? block.tag : 0) << " ";
+            if (block.validBit && (block.dirtyBit == 1)) {
                cout << "D ";
             }
             else
@@ -631,16 +1177,166 @@ void Cache::print_perf_params() {
     cout << "g. total memory traffic:		" << dec << mem_traffic << endl;
 }
 
+// Serializes counters, block and victim cache contents (plus their sector masks if sectored)
+// Stream buffers are not kept (only active at the last level) and the write buffer must be drained first
+void Cache::save_state(vector<uint8_t> &state) {
+    uint32_t counters[12] = { reads, read_misses, writes, write_misses, writebacks, prefetches, read_prefetch, read_prefetch_misses, mem_traffic, victim_hits, write_throughs, writes_absorbed };
+    const uint8_t* raw = (const uint8_t*)counters;
+    state.assign(raw, raw + sizeof(counters));
+
+    for (uint32_t i = 0; i < numSets; i++) {
+        raw = (const uint8_t*)mySet[i].blocks;
+        state.insert(state.end(), raw, raw + assoc * sizeof(Cache_Block));
+    }
+
+    raw = (const uint8_t*)victimCache;
+    state.insert(state.end(), raw, raw + victimBlocks * sizeof(Cache_Block));
+
+    if (sectors > 1) {
+        raw = (const uint8_t*)blockMasks;
+        state.insert(state.end(), raw, raw + numSets * assoc * sizeof(Sector_Masks));
+        raw = (const uint8_t*)victimMasks;
+        state.insert(state.end(), raw, raw + victimBlocks * sizeof(Sector_Masks));
+    }
+}
+
+// Restores what save_state() wrote; fails if the geometry does not match
+bool Cache::load_state(const vector<uint8_t> &state) {
+    uint32_t counters[12];
+    size_t maskBytes = (sectors > 1) ? sizeof(Sector_Masks) : 0;
+    if (state.size() != sizeof(counters) + (numSets * assoc + victimBlocks) * (sizeof(Cache_Block) + maskBytes)) {
+        return false;
+    }
+
+    memcpy(counters, state.data(), sizeof(counters));
+    reads                = counters[0];
+    read_misses          = counters[1];
+    writes               = counters[2];
+    write_misses         = counters[3];
+    writebacks           = counters[4];
+    prefetches           = counters[5];
+    read_prefetch        = counters[6];
+    read_prefetch_misses = counters[7];
+    mem_traffic          = counters[8];
+    victim_hits          = counters[9];
+    write_throughs       = counters[10];
+    writes_absorbed      = counters[11];
+
+    const uint8_t* raw = state.data() + sizeof(counters);
+    for (uint32_t i = 0; i < numSets; i++) {
+        memcpy(mySet[i].blocks, raw, assoc * sizeof(Cache_Block));
+        raw += assoc * sizeof(Cache_Block);
+    }
+    if (victimBlocks > 0) {
+        memcpy(victimCache, raw, victimBlocks * sizeof(Cache_Block));
+        raw += victimBlocks * sizeof(Cache_Block);
+    }
+
+    if (sectors > 1) {
+        memcpy(blockMasks, raw, numSets * assoc * sizeof(Sector_Masks));
+        raw += numSets * assoc * sizeof(Sector_Masks);
+        if (victimBlocks > 0) {
+            memcpy(victimMasks, raw, victimBlocks * sizeof(Sector_Masks));
+        }
+    }
+
+    lastHit = NULL;
+    return true;
+}
+
+// Fills snap with counters, sets and stream buffers in LRU order (see snapshot.h)
+// Victim cache, write buffer and sector masks have no reference counterpart and are not included
+void Cache::snapshot(Cache_Snapshot &snap) {
+    snap.assoc = assoc;
+    snap.bufferWords = 2 + streamMemoryBlocks;
+    snap.counters = { reads, read_misses, writes, write_misses, writebacks, prefetches, read_prefetch, read_prefetch_misses, mem_traffic };
+    snap.blocks.clear();
+    snap.buffers.clear();
+
+    for (uint32_t i = 0; i < numSets; i++) {
+        vector<pair<uint32_t, uint32_t>> order;
+        for (uint32_t j = 0; j < assoc; j++) {
+            order.push_back({mySet[i].blocks[j].lru_counter, j});
+        }
+        stable_sort(order.begin(), order.end());
+
+        for (const auto& way : order) {
+            const Cache_Block& block = mySet[i].blocks[way.second];
+            snap.blocks.insert(snap.blocks.end(), { block.lru_counter, block.validBit, block.dirtyBit, block.tag });
+        }
+    }
+
+    if (buffer_active) {
+        vector<pair<uint32_t, uint32_t>> order;
+        for (uint32_t i = 0; i < streamBuffers; i++) {
+            order.push_back({mybuffer[i].buffer_lru, i});
+        }
+        stable_sort(order.begin(), order.end());
+
+        for (const auto& buffer : order) {
+            snap.buffers.push_back(mybuffer[buffer.second].buffer_lru);
+            snap.buffers.push_back(mybuffer[buffer.second].valid_prefetch);
+            for (uint32_t j = 0; j < streamMemoryBlocks; j++) {
+                snap.buffers.push_back(mybuffer[buffer.second].prefetch_blocks[j].buffer_block);
+            }
+        }
+    }
+}
+
+// True if the block holding addr is valid in the sets or the victim cache
+bool Cache::holds(uint32_t addr) {
+    uint32_t bits[3];
+    get_bits(bits, addr);
+
+    for (uint32_t i = 0; i < assoc; i++) {
+        if (mySet[bits[1]].blocks[i].validBit && (bits[2] == mySet[bits[1]].blocks[i].tag)) {
+            return true;
+        }
+    }
+
+    uint32_t block_addr = addr >> blockOffsetBits;
+    for (uint32_t i = 0; i < victimBlocks; i++) {
+        if (victimCache[i].validBit && (victimCache[i].tag == block_addr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Block addresses of every valid block in the sets and the victim cache (used to check inclusion policies)
+void Cache::resident_blocks(vector<uint32_t> &addrs) {
+    addrs.clear();
+    for (uint32_t i = 0; i < numSets; i++) {
+        for (uint32_t j = 0; j < assoc; j++) {
+            if (mySet[i].blocks[j].validBit) {
+                addrs.push_back((mySet[i].blocks[j].tag << (indexBits + blockOffsetBits)) + (i << blockOffsetBits));
+            }
+        }
+    }
+
+    for (uint32_t j = 0; j < victimBlocks; j++) {
+        if (victimCache[j].validBit) {
+            addrs.push_back(victimCache[j].tag << blockOffsetBits);
+        }
+    }
+}
+
 // Good ol' destructor
 Cache::~Cache() {
     for (uint32_t i = 0; i < numSets; i++) {
         for (uint32_t j = 0; j < assoc; j++) {
             if (mySet[i].blocks[j].validBit && mySet[i].blocks[j].dirtyBit) {
-                writebacks++;
-                mem_traffic++;
+                writebacks += __builtin_popcount(dirty_sectors(mySet[i].blocks[j]));
+                mem_traffic += __builtin_popcount(dirty_sectors(mySet[i].blocks[j]));
             }
         }
-        delete[] mySet[i].blocks;
     }
-    delete[] mySet;
+
+    for (uint32_t j = 0; j < victimBlocks; j++) {
+        if (victimCache[j].validBit && victimCache[j].dirtyBit) {
+            writebacks += __builtin_popcount(dirty_sectors(victimCache[j]));
+            mem_traffic += __builtin_popcount(dirty_sectors(victimCache[j]));
+        }
+    }
+    delete ownArena;
 }
\ No newline at end of file
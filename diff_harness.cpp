@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "cache.h"
+#include "ref_cache.h"
+
+/*  Differential harness: runs the frozen reference model (ref_cache.h) and the Cache engine (cache.h) in lockstep
+    over random and synthetic traces, compares counters and the full set/stream buffer state after every batch,
+    and on a mismatch replays that batch one access at a time to report the first access where they diverge.
+
+    Options the reference does not model (inclusion, victim caches, write policies and buffers, sectors) are
+    checked against the engine itself: the same-block fast path on vs. off, the inclusion/exclusion invariant
+    after every access, and a miss-stream record/replay run vs. the direct run.
+
+    Usage: ./diff_harness [<accesses per trace> [<seed>]]
+    Exit status is 0 if every configuration/trace pair matched, 1 otherwise.
+*/
+
+#define HARNESS_BATCH 1024      // Accesses between full state comparisons
+#define HARNESS_STREAM "diff_harness.mss"      // Miss-stream file written and removed by the replay check
+
+using namespace std;
+
+// Hierarchy configuration (same meaning as the sim command line; L2_SIZE = 0 means no L2)
+typedef struct {
+   uint32_t BLOCKSIZE;
+   uint32_t L1_SIZE;
+   uint32_t L1_ASSOC;
+   uint32_t L2_SIZE;
+   uint32_t L2_ASSOC;
+   uint32_t PREF_N;
+   uint32_t PREF_M;
+} harness_config_t;
+
+// One trace entry
+typedef struct {
+   char rw;
+   uint32_t addr;
+} access_t;
+
+// L1 (+ L2) built the way main() builds it, for either model
+template <class C>
+class Hierarchy {
+public:
+    C L2;
+    C L1;
+
+    Hierarchy(const harness_config_t &cfg)
+        : L2(cfg.L2_SIZE, cfg.L2_ASSOC, cfg.BLOCKSIZE, cfg.PREF_N, cfg.PREF_M, NULL),
+          L1(cfg.L1_SIZE, cfg.L1_ASSOC, cfg.BLOCKSIZE, cfg.PREF_N, cfg.PREF_M, (cfg.L2_SIZE > 0) ? &L2 : NULL)
+    {
+    }
+
+    void access(const access_t &a) {
+        if (a.rw == 'r') {
+            L1.cache_read(a.addr);
+        }
+        else {
+            L1.cache_write(a.addr);
+        }
+    }
+
+    void snapshot(Cache_Snapshot snap[2]) {
+        L1.snapshot(snap[0]);
+        L2.snapshot(snap[1]);
+    }
+};
+
+// Compares both levels; where names the level and the first difference
+bool hierarchy_equal(Hierarchy<Ref_Cache> &ref, Hierarchy<Cache> &eng, string &where) {
+    Cache_Snapshot refSnap[2], engSnap[2];
+    ref.snapshot(refSnap);
+    eng.snapshot(engSnap);
+
+    for (uint32_t level = 0; level < 2; level++) {
+        if (!snapshot_equal(refSnap[level], engSnap[level], where)) {
+            where = string(level == 0 ? "L1 " : "L2 ") + where;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Synthetic trace generators
+// Each one stresses a different path: conflicts and dirty evictions, same-block repeats (fast path),
+// sequential streams (stream buffer hits and the sync shortcut), and full 32-bit tags
+enum {
+    TRACE_UNIFORM,          // Uniform over a 1 MB footprint
+    TRACE_HOT,              // Small hot set with long same-block runs
+    TRACE_STREAMS,          // Interleaved ascending streams with occasional jumps
+    TRACE_BACKWARD,         // Descending streams (prefetch misses)
+    TRACE_CONFLICT,         // Strided addresses that map to a few sets
+    TRACE_WIDE,             // Uniform over the full 32-bit address space
+    TRACE_MIXED,            // Per-access mix of all of the above
+    NUM_TRACES
+};
+
+const char *trace_names[NUM_TRACES] = { "uniform", "hot", "streams", "backward", "conflict", "wide", "mixed" };
+
+void generate_trace(uint32_t kind, uint32_t length, uint32_t seed, const harness_config_t &cfg, vector<access_t> &trace) {
+    mt19937 rng(seed * NUM_TRACES + kind);
+    uint32_t streams[4] = { (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng() };
+    uint32_t hot[64];
+    for (uint32_t i = 0; i < 64; i++) {
+        hot[i] = rng() & 0xffff;
+    }
+    uint32_t setSpan = cfg.L1_SIZE / cfg.L1_ASSOC;      // Bytes between addresses that share an L1 set
+    uint32_t last = 0;
+
+    trace.clear();
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t k = (kind == TRACE_MIXED) ? rng() % TRACE_MIXED : kind;
+        uint32_t addr;
+
+        switch (k) {
+        case TRACE_UNIFORM:
+            addr = rng() & 0xfffff;
+            break;
+        case TRACE_HOT:
+            addr = (rng() % 4 != 0) ? last + (rng() % cfg.BLOCKSIZE) - (last % cfg.BLOCKSIZE) : hot[rng() % 64];
+            break;
+        case TRACE_STREAMS:
+        case TRACE_BACKWARD: {
+            uint32_t s = rng() % 4;
+            if (rng() % 64 == 0) {
+                streams[s] = rng();
+            }
+            // Mostly word steps; sometimes skip a few blocks so hits land deep in a stream buffer
+            uint32_t step = (rng() % 8 == 0) ? cfg.BLOCKSIZE * (1 + rng() % 4) : 4 * (1 + rng() % 4);
+            streams[s] += (k == TRACE_STREAMS) ? step : -step;
+            addr = streams[s];
+            break;
+        }
+        case TRACE_CONFLICT:
+            addr = (rng() % 16) * setSpan + (rng() % 4) * cfg.BLOCKSIZE + (rng() % cfg.BLOCKSIZE);
+            break;
+        default:
+            addr = rng();
+            break;
+        }
+
+        trace.push_back({ (rng() % 3 == 0) ? 'w' : 'r', addr });
+        last = addr;
+    }
+}
+
+// Runs one configuration over one trace; returns false (after reporting) on the first divergence
+bool run_pair(const harness_config_t &cfg, const char *trace_name, const vector<access_t> &trace) {
+    Hierarchy<Ref_Cache> *ref = new Hierarchy<Ref_Cache>(cfg);
+    Hierarchy<Cache> *eng = new Hierarchy<Cache>(cfg);
+    string where;
+    size_t batchStart = 0;
+    bool equal = true;
+
+    // Lockstep, compared per batch
+    for (; batchStart < trace.size(); batchStart += HARNESS_BATCH) {
+        size_t batchEnd = min(trace.size(), batchStart + HARNESS_BATCH);
+        for (size_t i = batchStart; i < batchEnd; i++) {
+            ref->access(trace[i]);
+            eng->access(trace[i]);
+        }
+        if (!hierarchy_equal(*ref, *eng, where)) {
+            equal = false;
+            break;
+        }
+    }
+
+    // Both matched at the end of the previous batch: rebuild, fast-forward there, then compare every access
+    if (!equal) {
+        delete ref;
+        delete eng;
+        ref = new Hierarchy<Ref_Cache>(cfg);
+        eng = new Hierarchy<Cache>(cfg);
+
+        for (size_t i = 0; i < batchStart; i++) {
+            ref->access(trace[i]);
+            eng->access(trace[i]);
+        }
+        for (size_t i = batchStart; i < trace.size(); i++) {
+            ref->access(trace[i]);
+            eng->access(trace[i]);
+            if (!hierarchy_equal(*ref, *eng, where)) {
+                printf("DIVERGED  trace %-9s first at access #%zu (%c %x): %s\n", trace_name, i, trace[i].rw, trace[i].addr, where.c_str());
+                break;
+            }
+        }
+    }
+
+    delete ref;
+    delete eng;
+    return equal;
+}
+
+// Hierarchy with the options the reference does not model (same meaning as the sim options)
+typedef struct {
+   harness_config_t geometry;
+   inclusion_t INCLUSION;
+   uint32_t L1_VICTIM;
+   uint32_t L2_VICTIM;
+   write_policy_t L1_WRITE;
+   write_policy_t L2_WRITE;
+   uint32_t L1_WBUF;
+   uint32_t L2_WBUF;
+   uint32_t SECTORS;
+} option_config_t;
+
+// Engine-only L1 (+ L2) with the options applied the way main() applies them
+class Option_Hierarchy {
+public:
+    Cache L2;
+    Cache L1;
+
+    Option_Hierarchy(const option_config_t &cfg, bool fastPath)
+        : L2(cfg.geometry.L2_SIZE, cfg.geometry.L2_ASSOC, cfg.geometry.BLOCKSIZE, cfg.geometry.PREF_N, cfg.geometry.PREF_M, NULL, cfg.SECTORS),
+          L1(cfg.geometry.L1_SIZE, cfg.geometry.L1_ASSOC, cfg.geometry.BLOCKSIZE, cfg.geometry.PREF_N, cfg.geometry.PREF_M,
+             (cfg.geometry.L2_SIZE > 0) ? &L2 : NULL, cfg.SECTORS)
+    {
+        L1.attach_victim_cache(cfg.L1_VICTIM);
+        L1.set_write_policy(cfg.L1_WRITE);
+        L1.attach_write_buffer(cfg.L1_WBUF);
+        L1.fastPath = fastPath;
+        if (cfg.geometry.L2_SIZE > 0) {
+            L2.attach_victim_cache(cfg.L2_VICTIM);
+            L2.set_write_policy(cfg.L2_WRITE);
+            L2.attach_write_buffer(cfg.L2_WBUF);
+            L1.inclusion = cfg.INCLUSION;
+            L2.inclusion = cfg.INCLUSION;
+            L2.prevCache = &L1;
+            L2.fastPath = fastPath;
+        }
+    }
+
+    void access(const access_t &a) {
+        if (a.rw == 'r') {
+            L1.cache_read(a.addr);
+        }
+        else {
+            L1.cache_write(a.addr);
+        }
+    }
+
+    // End of the trace: pending writes go down the same way they do in main()
+    void finish() {
+        L1.drain_write_buffer();
+        L2.drain_write_buffer();
+    }
+};
+
+// Compares snapshots, then the serialized state (adds victim entries, sector masks and the extra counters)
+// Differences name a as "ref" and b as "engine" (fast path on vs. off, direct run vs. replay)
+bool option_state_equal(Option_Hierarchy &a, Option_Hierarchy &b, string &where) {
+    Cache *levels[2][2] = { { &a.L1, &b.L1 }, { &a.L2, &b.L2 } };
+
+    for (uint32_t level = 0; level < 2; level++) {
+        Cache_Snapshot snapA, snapB;
+        vector<uint8_t> stateA, stateB;
+        levels[level][0]->snapshot(snapA);
+        levels[level][1]->snapshot(snapB);
+        if (!snapshot_equal(snapA, snapB, where)) {
+            where = string(level == 0 ? "L1 " : "L2 ") + where;
+            return false;
+        }
+
+        levels[level][0]->save_state(stateA);
+        levels[level][1]->save_state(stateB);
+        if (stateA != stateB) {
+            where = string(level == 0 ? "L1 " : "L2 ") + "victim cache, sector masks or write counters";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Same-block fast path on vs. off; compared per batch, then narrowed down to the first diverging access
+bool check_fast_path(const option_config_t &cfg, const char *trace_name, const vector<access_t> &trace) {
+    Option_Hierarchy *on = new Option_Hierarchy(cfg, true);
+    Option_Hierarchy *off = new Option_Hierarchy(cfg, false);
+    string where;
+    size_t batchStart = 0;
+    bool equal = true;
+
+    for (; batchStart < trace.size(); batchStart += HARNESS_BATCH) {
+        size_t batchEnd = min(trace.size(), batchStart + HARNESS_BATCH);
+        for (size_t i = batchStart; i < batchEnd; i++) {
+            on->access(trace[i]);
+            off->access(trace[i]);
+        }
+        if (!option_state_equal(*on, *off, where)) {
+            equal = false;
+            break;
+        }
+    }
+    if (equal) {
+        on->finish();
+        off->finish();
+        if (!option_state_equal(*on, *off, where)) {
+            printf("DIVERGED  trace %-9s fast path on vs. off, after draining the write buffers: %s\n", trace_name, where.c_str());
+            equal = false;
+        }
+        delete on;
+        delete off;
+        return equal;
+    }
+
+    delete on;
+    delete off;
+    on = new Option_Hierarchy(cfg, true);
+    off = new Option_Hierarchy(cfg, false);
+    for (size_t i = 0; i < batchStart; i++) {
+        on->access(trace[i]);
+        off->access(trace[i]);
+    }
+    for (size_t i = batchStart; i < trace.size(); i++) {
+        on->access(trace[i]);
+        off->access(trace[i]);
+        if (!option_state_equal(*on, *off, where)) {
+            printf("DIVERGED  trace %-9s fast path on vs. off, first at access #%zu (%c %x): %s\n", trace_name, i, trace[i].rw, trace[i].addr, where.c_str());
+            break;
+        }
+    }
+
+    delete on;
+    delete off;
+    return false;
+}
+
+// Inclusive: every block in L1 (sets or victim cache) is also in L2; exclusive: none is. Checked after every access
+bool check_inclusion(const option_config_t &cfg, const char *trace_name, const vector<access_t> &trace) {
+    Option_Hierarchy *h = new Option_Hierarchy(cfg, true);
+    vector<uint32_t> blocks;
+    bool holds = true;
+
+    for (size_t i = 0; (i < trace.size()) && holds; i++) {
+        h->access(trace[i]);
+        h->L1.resident_blocks(blocks);
+        for (uint32_t j = 0; j < blocks.size(); j++) {
+            if (h->L2.holds(blocks[j]) != (cfg.INCLUSION == INCLUSION_INCLUSIVE)) {
+                printf("VIOLATED  trace %-9s %s policy at access #%zu (%c %x): block %x is %s L2\n", trace_name,
+                       (cfg.INCLUSION == INCLUSION_INCLUSIVE) ? "inclusive" : "exclusive", i, trace[i].rw, trace[i].addr, blocks[j],
+                       (cfg.INCLUSION == INCLUSION_INCLUSIVE) ? "in L1 but not in" : "in both L1 and");
+                holds = false;
+                break;
+            }
+        }
+    }
+
+    delete h;
+    return holds;
+}
+
+// Records the L1 miss stream, replays it from the file into a fresh L2 and compares both levels with the direct run
+bool check_replay(const option_config_t &cfg, const char *trace_name, const vector<access_t> &trace) {
+    uint32_t unitSize = cfg.geometry.BLOCKSIZE / cfg.SECTORS;
+    vector<uint32_t> l1Config = { cfg.geometry.L1_SIZE, cfg.geometry.L1_ASSOC, cfg.L1_VICTIM, cfg.L1_WRITE, cfg.L1_WBUF, cfg.SECTORS };
+    Option_Hierarchy *direct = new Option_Hierarchy(cfg, true);
+    Miss_Stream *recorded = new Miss_Stream(unitSize, Cache::state_format(), l1Config, 0);
+    direct->L1.missStream = recorded;
+    for (size_t i = 0; i < trace.size(); i++) {
+        direct->access(trace[i]);
+    }
+    direct->L1.drain_write_buffer();
+    direct->L1.save_state(recorded->l1_state);
+    direct->L1.missStream = NULL;
+    direct->L2.drain_write_buffer();
+    bool saved = recorded->save(HARNESS_STREAM);
+
+    Option_Hierarchy *replayed = new Option_Hierarchy(cfg, true);
+    Miss_Stream *loaded = new Miss_Stream(unitSize, Cache::state_format(), l1Config, 0);
+    bool equal = saved && loaded->load(HARNESS_STREAM) && replayed->L1.load_state(loaded->l1_state);
+    remove(HARNESS_STREAM);
+    string where = "unable to save or load the stream";
+    if (equal) {
+        char rw;
+        uint32_t addr;
+        while (loaded->next(rw, addr)) {
+            if (rw == 'r') {
+                replayed->L2.cache_read(addr);
+            }
+            else {
+                replayed->L2.cache_write(addr);
+            }
+        }
+        replayed->L2.drain_write_buffer();
+        equal = (loaded->size() == recorded->size()) && option_state_equal(*direct, *replayed, where);
+    }
+    if (!equal) {
+        printf("DIVERGED  trace %-9s miss-stream replay vs. direct run: %s\n", trace_name, where.c_str());
+    }
+
+    delete direct;
+    delete replayed;
+    delete recorded;
+    delete loaded;
+    return equal;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t length = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100000;
+    uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+
+    // BLOCKSIZE L1_SIZE L1_ASSOC L2_SIZE L2_ASSOC PREF_N PREF_M
+    const harness_config_t configs[] = {
+        {  16,  1024,  1,      0,  0, 0,  0 },     // Direct-mapped L1 only
+        {  32,  8192,  4,      0,  0, 0,  0 },     // L1 only
+        {  32,  1024,  2,      0,  0, 3,  4 },     // L1 with stream buffers
+        {  32,   256,  1,      0,  0, 1, 10 },     // Tiny L1, one long stream buffer
+        {  32,  8192,  4, 262144,  8, 0,  0 },     // L1 + L2
+        {  32,  1024,  2,  16384,  4, 2,  3 },     // L1 + L2 with stream buffers at L2
+        {  64,  2048, 32,   8192,  4, 1,  1 },     // Fully-associative L1
+        {  16,   512,  8,   4096, 16, 4,  6 },     // Small, highly associative
+    };
+    uint32_t numConfigs = sizeof(configs) / sizeof(configs[0]);
+    uint32_t failures = 0;
+    vector<access_t> trace;
+
+    printf("===== Differential harness (reference vs. engine, %u accesses per trace, seed %u) =====\n", length, seed);
+    for (uint32_t c = 0; c < numConfigs; c++) {
+        const harness_config_t &cfg = configs[c];
+        printf("config %u %u %u %u %u %u %u\n", cfg.BLOCKSIZE, cfg.L1_SIZE, cfg.L1_ASSOC, cfg.L2_SIZE, cfg.L2_ASSOC, cfg.PREF_N, cfg.PREF_M);
+
+        for (uint32_t t = 0; t < NUM_TRACES; t++) {
+            generate_trace(t, length, seed, cfg, trace);
+            if (!run_pair(cfg, trace_names[t], trace)) {
+                failures++;
+            }
+        }
+    }
+
+    printf("%u of %u configuration/trace pairs diverged\n", failures, numConfigs * NUM_TRACES);
+
+    // BLOCKSIZE L1_SIZE L1_ASSOC L2_SIZE L2_ASSOC PREF_N PREF_M, INCLUSION, L1/L2 victim, L1/L2 write policy, L1/L2 write buffer, SECTORS
+    const option_config_t options[] = {
+        { {  32,  1024,  2,  16384,  4, 2,  3 }, INCLUSION_INCLUSIVE, 0, 0, WRITE_WBWA,   WRITE_WBWA,   0, 0, 1 },   // Inclusive with stream buffers
+        { {  32,  1024,  2,   8192,  4, 0,  0 }, INCLUSION_INCLUSIVE, 4, 8, WRITE_WBWA,   WRITE_WBWA,   0, 0, 1 },   // Inclusive with victim caches
+        { {  16,   512,  2,   4096,  4, 1,  2 }, INCLUSION_INCLUSIVE, 2, 3, WRITE_WT,     WRITE_NWA,    4, 2, 2 },   // Inclusive, sectored, write policies
+        { {  32,  1024,  2,  16384,  4, 2,  3 }, INCLUSION_EXCLUSIVE, 0, 0, WRITE_WBWA,   WRITE_WBWA,   0, 0, 1 },   // Exclusive with stream buffers
+        { {  32,  1024,  2,   8192,  8, 0,  0 }, INCLUSION_EXCLUSIVE, 2, 4, WRITE_WBWA,   WRITE_WBWA,   0, 0, 1 },   // Exclusive with victim caches
+        { {  32,  8192,  4,      0,  0, 2,  4 }, INCLUSION_NINE,      8, 0, WRITE_WT,     WRITE_WBWA,   4, 0, 1 },   // L1 only: victim cache, write buffer
+        { {  32,  1024,  2,  16384,  4, 2,  3 }, INCLUSION_NINE,      2, 4, WRITE_WBWA,   WRITE_WBWA,   0, 0, 1 },   // Victim caches at both levels
+        { {  32,  1024,  2,  16384,  4, 0,  0 }, INCLUSION_NINE,      0, 0, WRITE_WT,     WRITE_WBWA,   4, 2, 1 },   // Write-through with write buffers
+        { {  32,  1024,  2,  16384,  4, 1,  4 }, INCLUSION_NINE,      0, 0, WRITE_NWA,    WRITE_AROUND, 0, 2, 1 },   // No-write-allocate / write-around
+        { {  64,  2048,  4,  16384,  8, 2,  4 }, INCLUSION_NINE,      2, 0, WRITE_AROUND, WRITE_WBWA,   2, 0, 8 },   // Sectored, write-around L1
+        { {  32,  1024,  2,   8192,  4, 0,  0 }, INCLUSION_NINE,      0, 2, WRITE_WBWA,   WRITE_NWA,    0, 0, 4 },   // Sectored, victim cache at L2
+    };
+    const char *inclusion_names[] = { "nine", "inclusive", "exclusive" };
+    const char *write_names[] = { "wbwa", "wt", "nwa", "around" };
+    uint32_t numOptions = sizeof(options) / sizeof(options[0]);
+    uint32_t optionFailures = 0;
+    uint32_t checks = 0;
+
+    printf("\n===== Option checks (engine only: fast path on vs. off, inclusion invariant, miss-stream replay) =====\n");
+    for (uint32_t c = 0; c < numOptions; c++) {
+        const option_config_t &cfg = options[c];
+        const harness_config_t &geo = cfg.geometry;
+        bool hasL2 = (geo.L2_SIZE > 0);
+        printf("options %u %u %u %u %u %u %u --inclusion %s --l1-victim %u --l2-victim %u --l1-write %s --l2-write %s --l1-write-buffer %u --l2-write-buffer %u --sectors %u\n",
+               geo.BLOCKSIZE, geo.L1_SIZE, geo.L1_ASSOC, geo.L2_SIZE, geo.L2_ASSOC, geo.PREF_N, geo.PREF_M, inclusion_names[cfg.INCLUSION],
+               cfg.L1_VICTIM, cfg.L2_VICTIM, write_names[cfg.L1_WRITE], write_names[cfg.L2_WRITE], cfg.L1_WBUF, cfg.L2_WBUF, cfg.SECTORS);
+
+        for (uint32_t t = 0; t < NUM_TRACES; t++) {
+            generate_trace(t, length, seed, geo, trace);
+            checks++;
+            if (!check_fast_path(cfg, trace_names[t], trace)) {
+                optionFailures++;
+            }
+            // Inclusion only applies between two levels; replay only under nine (L1 contents depend on L2 otherwise)
+            if (hasL2 && (cfg.INCLUSION != INCLUSION_NINE)) {
+                checks++;
+                if (!check_inclusion(cfg, trace_names[t], trace)) {
+                    optionFailures++;
+                }
+            }
+            if (hasL2 && (cfg.INCLUSION == INCLUSION_NINE)) {
+                checks++;
+                if (!check_replay(cfg, trace_names[t], trace)) {
+                    optionFailures++;
+                }
+            }
+        }
+    }
+
+    printf("%u of %u option checks failed\n", optionFailures, checks);
+    return ((failures > 0) || (optionFailures > 0)) ? 1 : 0;
+}
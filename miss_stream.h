@@ -0,0 +1,208 @@
+#ifndef MISS_STREAM_H
+#define MISS_STREAM_H
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <cmath>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define MISS_STREAM_MAGIC   0x3553534d      // "MSS5"
+
+// Filtered miss-stream (the requests L1 sends to its next level)
+// Records are stored as varints: zigzag(block delta) << 1 | write, so a sequential stream costs ~1 byte per request
+// The file also carries the final L1 state so a replay run can print L1 without simulating it
+class Miss_Stream {
+private:
+    // Key parameters
+    uint32_t unitSize;                      // Transfer unit of L1 and L2 (block, or sector if sectored)
+    uint32_t stateFormat;                   // Layout of the L1 state blob (see Cache::state_format)
+    vector<uint32_t> l1Config;              // Every L1 parameter that changes what L1 sends down
+    uint64_t traceHash;                     // FNV-1a hash of the trace file
+
+    uint32_t unitOffsetBits;                // Number of offset bits of the transfer unit
+
+    // Stream
+    vector<uint8_t> records;                // Encoded requests
+    uint64_t numRecords = 0;                // Number of requests
+    uint32_t lastBlock = 0;                 // Previous block address (delta base)
+    size_t cursor = 0;                      // Replay position
+
+    void put_varint(uint64_t value);
+    bool get_varint(uint64_t &value);
+
+public:
+    vector<uint8_t> l1_state;               // Opaque L1 state blob (see Cache::save_state)
+
+    Miss_Stream(uint32_t unitSize, uint32_t stateFormat, const vector<uint32_t> &l1Config, uint64_t traceHash);
+    string file_name(const char* dir);
+    void record(char rw, uint32_t addr);
+    bool next(char &rw, uint32_t &addr);
+    uint64_t size() { return numRecords; }
+    bool save(const char* path);
+    bool load(const char* path);
+    void reset();
+
+    static uint64_t hash_file(const char* path);
+};
+
+Miss_Stream::Miss_Stream(uint32_t unitSize, uint32_t stateFormat, const vector<uint32_t> &l1Config, uint64_t traceHash)
+    : unitSize(unitSize), stateFormat(stateFormat), l1Config(l1Config), traceHash(traceHash)
+{
+    unitOffsetBits = log2(unitSize);
+}
+
+// Stream file name, unique per L1 configuration and trace
+string Miss_Stream::file_name(const char* dir) {
+    string name = string(dir) + "/l1_" + to_string(unitSize);
+    for (uint32_t i = 0; i < l1Config.size(); i++) {
+        name += "_" + to_string(l1Config[i]);
+    }
+
+    char hash[24];
+    snprintf(hash, sizeof(hash), "_%016" PRIx64 ".mss", traceHash);
+    return name + hash;
+}
+
+// Appends one request (only the block/sector address is kept; L2 shares the transfer unit)
+void Miss_Stream::record(char rw, uint32_t addr) {
+    uint32_t block = addr >> unitOffsetBits;
+    int64_t delta = (int64_t)block - (int64_t)lastBlock;
+    uint64_t zigzag = (delta < 0) ? (((uint64_t)(-delta) << 1) - 1) : ((uint64_t)delta << 1);
+
+    put_varint((zigzag << 1) | (rw == 'w'));
+    lastBlock = block;
+    numRecords++;
+}
+
+// Returns the next request in order; false once the stream is exhausted
+bool Miss_Stream::next(char &rw, uint32_t &addr) {
+    uint64_t value;
+    if (!get_varint(value)) {
+        return false;
+    }
+
+    uint64_t zigzag = value >> 1;
+    int64_t delta = (zigzag & 1) ? -(int64_t)((zigzag + 1) >> 1) : (int64_t)(zigzag >> 1);
+
+    lastBlock = (uint32_t)((int64_t)lastBlock + delta);
+    rw = (value & 1) ? 'w' : 'r';
+    addr = lastBlock << unitOffsetBits;
+    return true;
+}
+
+void Miss_Stream::put_varint(uint64_t value) {
+    while (value >= 0x80) {
+        records.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    records.push_back((uint8_t)value);
+}
+
+bool Miss_Stream::get_varint(uint64_t &value) {
+    value = 0;
+    for (uint32_t shift = 0; cursor < records.size(); shift += 7) {
+        uint8_t byte = records[cursor++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// File layout: magic, unit size, state format, key length, key, trace hash, record count, record bytes, L1 state bytes
+// Written to a temporary name first so an interrupted run never leaves a truncated stream behind
+bool Miss_Stream::save(const char* path) {
+    string tmp = string(path) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    uint32_t header[4] = { MISS_STREAM_MAGIC, unitSize, stateFormat, (uint32_t)l1Config.size() };
+    uint64_t sizes[3] = { numRecords, records.size(), l1_state.size() };
+    bool ok = (fwrite(header, sizeof(header), 1, fp) == 1)
+           && (fwrite(l1Config.data(), sizeof(uint32_t), l1Config.size(), fp) == l1Config.size())
+           && (fwrite(&traceHash, sizeof(traceHash), 1, fp) == 1)
+           && (fwrite(sizes, sizeof(sizes), 1, fp) == 1)
+           && (fwrite(records.data(), 1, records.size(), fp) == records.size())
+           && (fwrite(l1_state.data(), 1, l1_state.size(), fp) == l1_state.size());
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || (rename(tmp.c_str(), path) != 0)) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Loads a stream; fails if the file is missing, truncated, was recorded for another key or holds another state layout
+bool Miss_Stream::load(const char* path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    uint32_t header[4];
+    vector<uint32_t> config(l1Config.size());
+    uint64_t hash;
+    uint64_t sizes[3];
+    bool ok = (fread(header, sizeof(header), 1, fp) == 1)
+           && (header[0] == MISS_STREAM_MAGIC) && (header[1] == unitSize) && (header[2] == stateFormat) && (header[3] == l1Config.size())
+           && (fread(config.data(), sizeof(uint32_t), config.size(), fp) == config.size()) && (config == l1Config)
+           && (fread(&hash, sizeof(hash), 1, fp) == 1)
+           && (fread(sizes, sizeof(sizes), 1, fp) == 1)
+           && (hash == traceHash);
+
+    if (ok) {
+        records.resize(sizes[1]);
+        l1_state.resize(sizes[2]);
+        ok = (fread(records.data(), 1, records.size(), fp) == records.size())
+          && (fread(l1_state.data(), 1, l1_state.size(), fp) == l1_state.size());
+    }
+    fclose(fp);
+
+    if (!ok) {
+        reset();
+        return false;
+    }
+    numRecords = sizes[0];
+    lastBlock = 0;
+    cursor = 0;
+    return true;
+}
+
+// Drops whatever was loaded so the stream can be recorded from scratch
+void Miss_Stream::reset() {
+    records.clear();
+    l1_state.clear();
+    numRecords = 0;
+    lastBlock = 0;
+    cursor = 0;
+}
+
+// FNV-1a over the raw trace bytes
+uint64_t Miss_Stream::hash_file(const char* path) {
+    FILE *fp = fopen(path, "rb");
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    if (fp == NULL) {
+        return hash;
+    }
+
+    uint8_t chunk[1 << 16];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= chunk[i];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    fclose(fp);
+    return hash;
+}
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+#endif
+
+// Simulator phases the self-profile is split into
+enum {
+    PHASE_NONE,             // Setup and printing (not reported)
+    PHASE_PARSE,            // Reading and parsing the trace
+    PHASE_HIERARCHY,        // cache_read/cache_write through the hierarchy (excluding the prefetch unit)
+    PHASE_PREFETCH,         // Stream buffer lookup and refill
+    NUM_PHASES
+};
+
+#define PROFILE_EVENTS 4    // cycles, instructions, LLC misses, branch misses
+#define PROFILE_SAMPLE_PERIOD 64    // Calls per measured call for phases entered through Sampled_Scope
+#define PROFILE_CALIBRATION 256     // Back-to-back reads used to estimate the cost of one read
+
+// Host-side profile of the simulator itself (--self-profile)
+// One perf_event_open group is read at every phase switch and the delta is charged to the phase being left,
+// so nested phases (prefetch inside the hierarchy) are reported exclusively.
+// Counters are read in user space with rdpmc through each event's mmap page when the kernel allows it,
+// otherwise with a read() syscall on the group. Falls back to wall clock only if perf events cannot be opened.
+class Self_Profiler {
+private:
+    int fds[PROFILE_EVENTS];                // Event fds (-1 if unavailable); fds[0] is the group leader
+    uint32_t slot[PROFILE_EVENTS];          // Position of each event in the group read
+    uint32_t numOpen = 0;                   // Number of events in the group
+    bool perfActive = false;                // Flag to track if hardware counters are being read
+    bool userRead = false;                  // Flag to track if counters are read with rdpmc (no syscall)
+#ifdef __linux__
+    struct perf_event_mmap_page* pages[PROFILE_EVENTS];    // User page of each event (NULL if not mapped)
+#endif
+    char fallbackReason[64];                // Why perf events are not used
+
+    uint32_t current = PHASE_NONE;          // Phase being charged
+    uint64_t last[PROFILE_EVENTS + 1];      // Counter values (and wall ns) at the last switch
+    uint64_t totals[NUM_PHASES][PROFILE_EVENTS + 1];
+
+    // Sampled phases (see Sampled_Scope)
+    uint64_t calls[NUM_PHASES];             // Calls made
+    uint64_t measured[NUM_PHASES];          // Calls actually measured
+    uint32_t countdown[NUM_PHASES];         // Calls until the next measured one
+    uint32_t parent[NUM_PHASES];            // Phase the sampled phase is entered from (charged with the unmeasured calls)
+    uint64_t overhead[PROFILE_EVENTS + 1];  // Cost of one sample() (a measured call pays about one in each phase)
+
+    void sample(uint64_t values[]);
+    bool read_user(uint64_t values[]);
+
+public:
+    Self_Profiler();
+    ~Self_Profiler();
+    uint32_t enter(uint32_t phase);
+    bool measure_call(uint32_t phase);
+    void report(uint64_t accesses);
+};
+
+// Charges the enclosing scope to a phase and restores the previous one on exit (no-op without a profiler)
+// Each switch reads the counters (a syscall), so use it only for scopes entered a few times per batch
+class Profile_Scope {
+private:
+    Self_Profiler* profiler;
+    uint32_t previous;
+
+public:
+    Profile_Scope(Self_Profiler* profiler, uint32_t phase) : profiler(profiler) {
+        if (profiler != NULL) {
+            previous = profiler->enter(phase);
+        }
+    }
+    ~Profile_Scope() {
+        if (profiler != NULL) {
+            profiler->enter(previous);
+        }
+    }
+};
+
+// Like Profile_Scope, for phases entered on every access (the prefetch unit)
+// Only one call in PROFILE_SAMPLE_PERIOD switches phases; the others run unmeasured inside the parent phase
+// and report() moves their estimated cost from the parent to the sampled phase
+class Sampled_Scope {
+private:
+    Self_Profiler* profiler;
+    uint32_t previous;
+    bool active = false;
+
+public:
+    Sampled_Scope(Self_Profiler* profiler, uint32_t phase) : profiler(profiler) {
+        if ((profiler != NULL) && profiler->measure_call(phase)) {
+            active = true;
+            previous = profiler->enter(phase);
+        }
+    }
+    ~Sampled_Scope() {
+        if (active) {
+            profiler->enter(previous);
+        }
+    }
+};
+
+Self_Profiler::Self_Profiler() {
+    memset(totals, 0, sizeof(totals));
+    memset(calls, 0, sizeof(calls));
+    memset(measured, 0, sizeof(measured));
+    for (uint32_t p = 0; p < NUM_PHASES; p++) {
+        countdown[p] = 1;
+        parent[p] = PHASE_NONE;
+    }
+    strcpy(fallbackReason, "not supported on this platform");
+
+    for (uint32_t i = 0; i < PROFILE_EVENTS; i++) {
+        fds[i] = -1;
+        slot[i] = 0;
+#ifdef __linux__
+        pages[i] = NULL;
+#endif
+    }
+
+#ifdef __linux__
+    const uint32_t types[PROFILE_EVENTS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+    const uint64_t configs[PROFILE_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+    for (uint32_t i = 0; i < PROFILE_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = (i == 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, (i == 0) ? -1 : fds[0], 0);
+        if (fds[i] < 0) {
+            // Without the leader there is no group; other events are simply reported as n/a
+            if (i == 0) {
+                snprintf(fallbackReason, sizeof(fallbackReason), "%s", strerror(errno));
+                break;
+            }
+            continue;
+        }
+        slot[i] = numOpen++;
+    }
+
+    if (fds[0] >= 0) {
+        perfActive = true;
+
+#if defined(__x86_64__) || defined(__i386__)
+        // Map each event's user page; rdpmc needs every open event to allow it
+        userRead = true;
+        for (uint32_t i = 0; i < PROFILE_EVENTS; i++) {
+            if (fds[i] < 0) {
+                continue;
+            }
+            void* p = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fds[i], 0);
+            if (p == MAP_FAILED) {
+                userRead = false;
+                continue;
+            }
+            pages[i] = (struct perf_event_mmap_page*)p;
+            userRead = userRead && pages[i]->cap_user_rdpmc;
+        }
+#endif
+
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+
+    // Calibrate the cost of reading the counters
+    uint64_t start[PROFILE_EVENTS + 1], end[PROFILE_EVENTS + 1], scratch[PROFILE_EVENTS + 1];
+    sample(start);
+    for (uint32_t k = 0; k < PROFILE_CALIBRATION; k++) {
+        sample(scratch);
+    }
+    sample(end);
+    for (uint32_t i = 0; i <= PROFILE_EVENTS; i++) {
+        overhead[i] = (end[i] - start[i]) / (PROFILE_CALIBRATION + 1);
+    }
+
+    sample(last);
+}
+
+Self_Profiler::~Self_Profiler() {
+#ifdef __linux__
+    for (uint32_t i = 0; i < PROFILE_EVENTS; i++) {
+        if (pages[i] != NULL) {
+            munmap(pages[i], sysconf(_SC_PAGESIZE));
+        }
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+#endif
+}
+
+// Reads all counters (values[0..3]) and the wall clock in ns (values[4])
+void Self_Profiler::sample(uint64_t values[]) {
+    for (uint32_t i = 0; i < PROFILE_EVENTS; i++) {
+        values[i] = 0;
+    }
+
+#ifdef __linux__
+    if (perfActive && !(userRead && read_user(values))) {
+        uint64_t buf[1 + PROFILE_EVENTS];
+        if (read(fds[0], buf, sizeof(buf)) > 0) {
+            for (uint32_t i = 0; i < PROFILE_EVENTS; i++) {
+                if (fds[i] >= 0) {
+                    values[i] = buf[1 + slot[i]];
+                }
+            }
+        }
+    }
+#endif
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    values[PROFILE_EVENTS] = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Reads all open counters with rdpmc (perf_event mmap page protocol); false if one is not on the PMU right now
+bool Self_Profiler::read_user(uint64_t values[]) {
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+    for (uint32_t i = 0; i < PROFILE_EVENTS; i++) {
+        if (fds[i] < 0) {
+            continue;
+        }
+
+        volatile struct perf_event_mmap_page* page = pages[i];
+        uint32_t seq;
+        uint64_t count;
+        do {
+            seq = page->lock;
+            __asm__ volatile("" ::: "memory");
+
+            uint32_t index = page->index;
+            if (index == 0) {
+                return false;
+            }
+            uint32_t lo, hi;
+            __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(index - 1));
+            uint32_t width = page->pmc_width;
+            int64_t pmc = (int64_t)(((uint64_t)hi << 32 | lo) << (64 - width)) >> (64 - width);
+            count = page->offset + pmc;
+
+            __asm__ volatile("" ::: "memory");
+        } while (page->lock != seq);
+
+        values[i] = count;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Charges everything since the last switch to the current phase, then switches; returns the phase that was left
+uint32_t Self_Profiler::enter(uint32_t phase) {
+    uint64_t now[PROFILE_EVENTS + 1];
+    sample(now);
+
+    for (uint32_t i = 0; i <= PROFILE_EVENTS; i++) {
+        totals[current][i] += now[i] - last[i];
+        last[i] = now[i];
+    }
+
+    uint32_t previous = current;
+    current = phase;
+    return previous;
+}
+
+// Counts a call of a sampled phase; true if this one should be measured (every PROFILE_SAMPLE_PERIOD-th call)
+// Never with syscall reads: their cost is microseconds and too noisy to subtract from a call that takes ~100 ns,
+// so the phase then stays inside its parent
+bool Self_Profiler::measure_call(uint32_t phase) {
+    calls[phase]++;
+    if ((perfActive && !userRead) || (--countdown[phase] > 0)) {
+        return false;
+    }
+    countdown[phase] = PROFILE_SAMPLE_PERIOD;
+    measured[phase]++;
+    parent[phase] = current;
+    return true;
+}
+
+// Prints host cost per simulated access for each phase
+void Self_Profiler::report(uint64_t accesses) {
+    const char *names[NUM_PHASES] = { "", "trace parsing", "hierarchy", "prefetch unit" };
+    double n = (accesses > 0) ? (double)accesses : 1.0;
+
+    // Scale sampled phases up to all their calls; the unmeasured calls ran inside the parent, so take it from there
+    // If the estimate exceeds what the parent measured, the split is noise: both cells print n/a instead of a clamped 0
+    double costs[NUM_PHASES][PROFILE_EVENTS + 1];
+    bool unreliable[NUM_PHASES][PROFILE_EVENTS + 1] = {};
+    for (uint32_t p = 0; p < NUM_PHASES; p++) {
+        for (uint32_t i = 0; i <= PROFILE_EVENTS; i++) {
+            costs[p][i] = (double)totals[p][i];
+        }
+    }
+    for (uint32_t p = 0; p < NUM_PHASES; p++) {
+        if (measured[p] == 0) {
+            continue;
+        }
+        for (uint32_t i = 0; i <= PROFILE_EVENTS; i++) {
+            // Remove the counter reads a measured call adds: about one falls inside the phase, one in the parent
+            double reads = (double)measured[p] * overhead[i];
+            costs[p][i] = std::max(costs[p][i] - reads, 0.0);
+            costs[parent[p]][i] = std::max(costs[parent[p]][i] - reads, 0.0);
+
+            double unmeasured = costs[p][i] * (calls[p] - measured[p]) / measured[p];
+            if (unmeasured > costs[parent[p]][i]) {
+                unreliable[p][i] = true;
+                unreliable[parent[p]][i] = true;
+                unmeasured = costs[parent[p]][i];
+            }
+            costs[p][i] += unmeasured;
+            costs[parent[p]][i] -= unmeasured;
+        }
+    }
+
+    printf("===== Self profile (host cost per simulated access, %" PRIu64 " accesses) =====\n", accesses);
+    if (!perfActive) {
+        printf("perf events unavailable (%s); wall clock only\n", fallbackReason);
+    }
+    else if (!userRead) {
+        printf("rdpmc unavailable (counters read with a syscall); the prefetch unit is included in the hierarchy row\n");
+    }
+    printf("%-16s%12s%12s%12s%12s%12s\n", "phase", "ns", "cycles", "instr", "LLC miss", "br miss");
+
+    for (uint32_t p = PHASE_PARSE; p < NUM_PHASES; p++) {
+        if ((calls[p] > 0) && (measured[p] == 0)) {
+            printf("%-16s%12s%12s%12s%12s%12s\n", names[p], "n/a", "n/a", "n/a", "n/a", "n/a");
+            continue;
+        }
+        if (unreliable[p][PROFILE_EVENTS]) {
+            printf("%-16s%12s", names[p], "n/a");
+        }
+        else {
+            printf("%-16s%12.2f", names[p], costs[p][PROFILE_EVENTS] / n);
+        }
+        for (uint32_t i = 0; i < PROFILE_EVENTS; i++) {
+            if (perfActive && (fds[i] >= 0) && !unreliable[p][i]) {
+                printf("%12.3f", costs[p][i] / n);
+            }
+            else {
+                printf("%12s", "n/a");
+            }
+        }
+        printf("\n");
+    }
+    if (measured[PHASE_PREFETCH] > 0) {
+        printf("prefetch unit: %" PRIu64 " of %" PRIu64 " calls measured, scaled to all calls; the prefetch unit and hierarchy rows are estimates\n", measured[PHASE_PREFETCH], calls[PHASE_PREFETCH]);
+        for (uint32_t i = 0; i <= PROFILE_EVENTS; i++) {
+            if (unreliable[PHASE_PREFETCH][i]) {
+                printf("n/a: the scaled prefetch estimate exceeded the measured hierarchy cost, so the split between them is unreliable\n");
+                break;
+            }
+        }
+    }
+    printf("\n");
+}
+
+#endif
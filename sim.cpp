@@ -1,10 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <iomanip> 
 #include "sim.h"
 #include "cache.h"
 
+#define TRACE_BATCH 65536     // Requests parsed per batch before they are simulated
+
 /*  "argc" holds the number of command-line arguments.
    "argv[]" holds the arguments themselves.
 
@@ -15,9 +18,34 @@
    argv[1] = "32"
    argv[2] = "8192"
    ... and so on
+
+   Optional flags may follow the trace file:
+   --miss-stream <dir>   Reuse (or record) the L1 miss-stream for this L1 configuration and trace
+   --inclusion <mode>    L1/L2 inclusion policy: nine (default), inclusive or exclusive
+   --l1-victim <blocks>  Attach a fully-associative victim cache to L1
+   --l2-victim <blocks>  Attach a fully-associative victim cache to L2
+   --l1-write <policy>   L1 write policy: wbwa (default), wt, nwa or around
+   --l2-write <policy>   L2 write policy
+   --l1-write-buffer <n> Coalescing write buffer between L1 and L2 (or memory)
+   --l2-write-buffer <n> Coalescing write buffer between L2 and memory
+   --sectors <n>         Split every block into n sectors with their own valid/dirty bits
+   --self-profile        Report host cycles/instructions/misses per simulated access for each simulator phase
+   --hugepages           Back the hierarchy's storage with transparent hugepages
 */
 using namespace std;
 
+// Parses a write policy name; exits on anything else
+write_policy_t parse_write_policy(const char *name) {
+   const char *names[] = { "wbwa", "wt", "nwa", "around" };
+   for (int i = 0; i < 4; i++) {
+      if (!strcmp(name, names[i])) {
+         return (write_policy_t) i;
+      }
+   }
+   printf("Error: Unknown write policy %s.\n", name);
+   exit(EXIT_FAILURE);
+}
+
 int main (int argc, char *argv[]) {
    FILE *fp;			            // File pointer.
    char *trace_file;		         // This variable holds the trace file name.
@@ -25,9 +53,12 @@ int main (int argc, char *argv[]) {
    char rw;			               // This variable holds the request's type (read or write) obtained from the trace.
    uint32_t addr;		            // This variable holds the request's address obtained from the trace.
 				                     // The header file <inttypes.h> above defines signed and unsigned integers of various sizes in a machine-agnostic way.  "uint32_t" is an unsigned integer of 32 bits.
+   char *miss_stream_dir = NULL;    // Directory holding recorded L1 miss-streams (NULL if disabled).
+   bool self_profile = false;       // Flag to track if the simulator profiles itself.
+   bool huge_pages = false;         // Flag to track if cache storage is advised for hugepages.
 
    // Exit with an error if the number of command-line arguments is incorrect.
-   if (argc != 9) {
+   if (argc < 9) {
       printf("Error: Expected 8 command-line arguments but was provided %d.\n", (argc - 1));
       exit(EXIT_FAILURE);
    }
@@ -41,6 +72,90 @@ int main (int argc, char *argv[]) {
    params.PREF_N    = (uint32_t) atoi(argv[6]);
    params.PREF_M    = (uint32_t) atoi(argv[7]);
    trace_file       = argv[8];
+   params.INCLUSION = INCLUSION_NINE;
+   params.L1_VICTIM = 0;
+   params.L2_VICTIM = 0;
+   params.L1_WRITE  = WRITE_WBWA;
+   params.L2_WRITE  = WRITE_WBWA;
+   params.L1_WBUF   = 0;
+   params.L2_WBUF   = 0;
+   params.SECTORS   = 1;
+
+   // Optional flags
+   for (int i = 9; i < argc; i++) {
+      if (!strcmp(argv[i], "--miss-stream") && (i + 1 < argc)) {
+         miss_stream_dir = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--inclusion") && (i + 1 < argc)) {
+         i++;
+         if (!strcmp(argv[i], "nine")) {
+            params.INCLUSION = INCLUSION_NINE;
+         }
+         else if (!strcmp(argv[i], "inclusive")) {
+            params.INCLUSION = INCLUSION_INCLUSIVE;
+         }
+         else if (!strcmp(argv[i], "exclusive")) {
+            params.INCLUSION = INCLUSION_EXCLUSIVE;
+         }
+         else {
+            printf("Error: Unknown inclusion policy %s.\n", argv[i]);
+            exit(EXIT_FAILURE);
+         }
+      }
+      else if (!strcmp(argv[i], "--l1-victim") && (i + 1 < argc)) {
+         params.L1_VICTIM = (uint32_t) atoi(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--l2-victim") && (i + 1 < argc)) {
+         params.L2_VICTIM = (uint32_t) atoi(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--l1-write") && (i + 1 < argc)) {
+         params.L1_WRITE = parse_write_policy(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--l2-write") && (i + 1 < argc)) {
+         params.L2_WRITE = parse_write_policy(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--l1-write-buffer") && (i + 1 < argc)) {
+         params.L1_WBUF = (uint32_t) atoi(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--l2-write-buffer") && (i + 1 < argc)) {
+         params.L2_WBUF = (uint32_t) atoi(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--sectors") && (i + 1 < argc)) {
+         params.SECTORS = (uint32_t) atoi(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--self-profile")) {
+         self_profile = true;
+      }
+      else if (!strcmp(argv[i], "--hugepages")) {
+         huge_pages = true;
+      }
+      else {
+         printf("Error: Unknown option %s.\n", argv[i]);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   // Exclusion moves blocks with insert/extract, which assumes plain write-back/write-allocate
+   if ((params.INCLUSION == INCLUSION_EXCLUSIVE) && ((params.L1_WRITE != WRITE_WBWA) || (params.L2_WRITE != WRITE_WBWA))) {
+      printf("Error: The exclusive inclusion policy requires the wbwa write policy.\n");
+      exit(EXIT_FAILURE);
+   }
+
+   // Sectors are tracked with one bit each in a 32-bit mask
+   if ((params.SECTORS == 0) || (params.SECTORS > 32) || (params.SECTORS & (params.SECTORS - 1)) || (params.SECTORS > params.BLOCKSIZE)) {
+      printf("Error: SECTORS must be a power of two between 1 and min(32, BLOCKSIZE).\n");
+      exit(EXIT_FAILURE);
+   }
+   if ((params.INCLUSION == INCLUSION_EXCLUSIVE) && (params.SECTORS > 1)) {
+      printf("Error: The exclusive inclusion policy requires unsectored caches.\n");
+      exit(EXIT_FAILURE);
+   }
+
+   // LRU ages are 16 bits wide
+   if ((params.L1_ASSOC > 65536) || (params.L2_ASSOC > 65536) || (params.L1_VICTIM > 65536) || (params.L2_VICTIM > 65536)) {
+      printf("Error: Associativity and victim cache entries are limited to 65536.\n");
+      exit(EXIT_FAILURE);
+   }
 
    // Open the trace file for reading.
    fp = fopen(trace_file, "r");
@@ -55,14 +170,43 @@ int main (int argc, char *argv[]) {
    // Chech if we need to create L2
    bool L2_present = params.L2_SIZE;
 
-   // Create L2 regardless (lol)
-   Cache L2_cache(params.L2_SIZE, params.L2_ASSOC, params.BLOCKSIZE, params.PREF_N, params.PREF_M, NULL);
+   // One arena holds every set, block, stream buffer and victim entry of the hierarchy (nothing for an absent L2)
+   size_t arena_bytes = Cache::storage_bytes(params.L1_SIZE, params.L1_ASSOC, params.BLOCKSIZE, params.PREF_N, params.PREF_M, !L2_present, params.L1_VICTIM, params.SECTORS);
+   if (L2_present) {
+      arena_bytes += Cache::storage_bytes(params.L2_SIZE, params.L2_ASSOC, params.BLOCKSIZE, params.PREF_N, params.PREF_M, true, params.L2_VICTIM, params.SECTORS);
+   }
+   Arena arena(arena_bytes, huge_pages);
 
-   // If L2_present==true, Set the pointer to L2 or else NULL
-   Cache *L2_pointer = L2_present ? &L2_cache : NULL;
+   // Create L2 only if it is present (NULL otherwise)
+   Cache *L2_cache = L2_present ? new Cache(params.L2_SIZE, params.L2_ASSOC, params.BLOCKSIZE, params.PREF_N, params.PREF_M, NULL, params.SECTORS, &arena) : NULL;
 
    // Create L1 cache instance 
-   Cache L1_cache(params.L1_SIZE, params.L1_ASSOC, params.BLOCKSIZE, params.PREF_N, params.PREF_M, L2_pointer);
+   Cache L1_cache(params.L1_SIZE, params.L1_ASSOC, params.BLOCKSIZE, params.PREF_N, params.PREF_M, L2_cache, params.SECTORS, &arena);
+
+   // Hierarchy options
+   L1_cache.attach_victim_cache(params.L1_VICTIM);
+   L1_cache.set_write_policy(params.L1_WRITE);
+   L1_cache.attach_write_buffer(params.L1_WBUF);
+   if (L2_present) {
+      L2_cache->attach_victim_cache(params.L2_VICTIM);
+      L2_cache->set_write_policy(params.L2_WRITE);
+      L2_cache->attach_write_buffer(params.L2_WBUF);
+      L1_cache.inclusion = params.INCLUSION;
+      L2_cache->inclusion = params.INCLUSION;
+      L2_cache->prevCache = &L1_cache;
+   }
+   // Self profile (counters start here so setup is not charged to any phase)
+   Self_Profiler *profiler = NULL;
+   if (self_profile) {
+      profiler = new Self_Profiler();
+      L1_cache.profiler = profiler;
+      if (L2_present) {
+         L2_cache->profiler = profiler;
+      }
+   }
+
+   bool extended = (params.INCLUSION != INCLUSION_NINE) || params.L1_VICTIM || params.L2_VICTIM
+                || (params.L1_WRITE != WRITE_WBWA) || (params.L2_WRITE != WRITE_WBWA) || params.L1_WBUF || params.L2_WBUF || (params.SECTORS > 1);
 
    // Print simulator configuration.
    printf("===== Simulator configuration =====\n");
@@ -74,31 +218,133 @@ int main (int argc, char *argv[]) {
    printf("PREF_N:     %u\n", params.PREF_N);
    printf("PREF_M:     %u\n", params.PREF_M);
    printf("trace_file: %s\n", trace_file);
+   if (extended) {
+      const char *inclusion_names[] = { "nine", "inclusive", "exclusive" };
+      printf("INCLUSION:  %s\n", inclusion_names[params.INCLUSION]);
+      printf("L1_VICTIM:  %u\n", params.L1_VICTIM);
+      printf("L2_VICTIM:  %u\n", params.L2_VICTIM);
+      const char *write_names[] = { "wbwa", "wt", "nwa", "around" };
+      printf("L1_WRITE:   %s\n", write_names[params.L1_WRITE]);
+      printf("L2_WRITE:   %s\n", write_names[params.L2_WRITE]);
+      printf("L1_WBUF:    %u\n", params.L1_WBUF);
+      printf("L2_WBUF:    %u\n", params.L2_WBUF);
+      printf("SECTORS:    %u\n", params.SECTORS);
+   }
    printf("\n");
 
-   // Read requests from the trace file and echo them back.
-   while (fscanf(fp, "%c %x\n", &rw, &addr) == 2) {	// Stay in the loop if fscanf() successfully parsed two tokens as specified.
-      if (rw == 'r') {
-         L1_cache.cache_read(addr);
+   // Filtered miss-stream; only meaningful when L1 feeds an L2
+   Miss_Stream *miss_stream = NULL;
+   string miss_stream_path;
+   bool replay = false;
+   if (miss_stream_dir != NULL) {
+      if (params.INCLUSION != INCLUSION_NINE) {
+         // L1 contents depend on L2 under inclusion/exclusion, so L1 cannot be skipped
+         fprintf(stderr, "Miss stream: ignored, only supported with the nine inclusion policy\n");
       }
-      else if (rw == 'w') {
-         L1_cache.cache_write(addr);
+      else if (L2_present) {
+         vector<uint32_t> l1_config = { params.L1_SIZE, params.L1_ASSOC, params.L1_VICTIM, params.L1_WRITE, params.L1_WBUF, params.SECTORS };
+         miss_stream = new Miss_Stream(params.BLOCKSIZE / params.SECTORS, Cache::state_format(), l1_config, Miss_Stream::hash_file(trace_file));
+         miss_stream_path = miss_stream->file_name(miss_stream_dir);
+         replay = miss_stream->load(miss_stream_path.c_str()) && L1_cache.load_state(miss_stream->l1_state);
+         if (!replay) {
+            // A stream that loaded but whose L1 state does not fit must not be appended to
+            miss_stream->reset();
+         }
       }
       else {
-         cout << "\nHERE" << endl;
-         printf("Error: Unknown request type %c.\n", rw);
-	      exit(EXIT_FAILURE);
+         fprintf(stderr, "Miss stream: ignored, no L2 to replay into\n");
+      }
+   }
+
+   if (replay) {
+      // Same L1 and trace as a previous run: feed only the recorded L1 requests to L2
+      fprintf(stderr, "Miss stream: replaying %" PRIu64 " requests from %s\n", miss_stream->size(), miss_stream_path.c_str());
+      Profile_Scope scope(profiler, PHASE_HIERARCHY);
+      while (miss_stream->next(rw, addr)) {
+         if (rw == 'r') {
+            L2_cache->cache_read(addr);
+         }
+         else {
+            L2_cache->cache_write(addr);
+         }
+      }
+   }
+   else {
+      L1_cache.missStream = miss_stream;
+
+      // Read requests from the trace file in batches, then run each batch through the hierarchy
+      // (keeps parsing and simulation apart so --self-profile only switches phases once per batch)
+      vector<char> batch_rw(TRACE_BATCH);
+      vector<uint32_t> batch_addr(TRACE_BATCH);
+      uint32_t batch_size;
+      do {
+         if (profiler != NULL) {
+            profiler->enter(PHASE_PARSE);
+         }
+         batch_size = 0;
+         while ((batch_size < TRACE_BATCH) && (fscanf(fp, "%c %x\n", &rw, &addr) == 2)) {	// Stay in the loop if fscanf() successfully parsed two tokens as specified.
+            if ((rw != 'r') && (rw != 'w')) {
+               cout << "\nHERE" << endl;
+               printf("Error: Unknown request type %c.\n", rw);
+	            exit(EXIT_FAILURE);
+            }
+            batch_rw[batch_size] = rw;
+            batch_addr[batch_size] = addr;
+            batch_size++;
+         }
+
+         if (profiler != NULL) {
+            profiler->enter(PHASE_HIERARCHY);
+         }
+         for (uint32_t i = 0; i < batch_size; i++) {
+            if (batch_rw[i] == 'r') {
+               L1_cache.cache_read(batch_addr[i]);
+            }
+            else {
+               L1_cache.cache_write(batch_addr[i]);
+            }
+         }
+      } while (batch_size == TRACE_BATCH);
+
+      // Flush pending writes so they reach L2 (and the stream) before the end of the run
+      L1_cache.drain_write_buffer();
+      if (profiler != NULL) {
+         profiler->enter(PHASE_NONE);
+      }
+
+      if (miss_stream != NULL) {
+         L1_cache.save_state(miss_stream->l1_state);
+         if (miss_stream->save(miss_stream_path.c_str())) {
+            fprintf(stderr, "Miss stream: recorded %" PRIu64 " requests to %s\n", miss_stream->size(), miss_stream_path.c_str());
+         }
+         else {
+            fprintf(stderr, "Miss stream: unable to write %s\n", miss_stream_path.c_str());
+         }
+         L1_cache.missStream = NULL;
       }
    }
+   fclose(fp);
+   if (L2_present) {
+      Profile_Scope scope(profiler, PHASE_HIERARCHY);
+      L2_cache->drain_write_buffer();
+   }
    
    // Print L1 contents
    cout << "===== L1 contents =====" << endl;
    L1_cache.print_block_contents();
+   if (params.L1_VICTIM) {
+      cout << "===== L1 victim cache contents =====" << endl;
+      L1_cache.print_victim_contents();
+   }
 
    // Print L2 contents (if L2 is present)
    if (L2_present) {
       cout << "===== L2 contents =====" << endl;
-      L2_cache.print_block_contents();
+      L2_cache->print_block_contents();
+      if (params.L2_VICTIM) {
+         cout << "===== L2 victim cache contents =====" << endl;
+         L2_cache->print_victim_contents();
+      }
    }
 
    // Print L1 buffer contents (if buffer is present)
@@ -107,13 +353,15 @@ int main (int argc, char *argv[]) {
    }
 
    // Print L2 buffer contents (if buffer is present)
-   if (L2_cache.buffer_active) {
-      L2_cache.print_buffer();
+   if (L2_present && L2_cache->buffer_active) {
+      L2_cache->print_buffer();
    }
 
    // Set parameters based on L2 presence
-   float mr2 = L2_present ? ((float)L2_cache.read_misses / (float)L2_cache.reads) : 0;
-   uint32_t mem_traffic = L2_present ? (L2_cache.read_misses + L1_cache.prefetches + L2_cache.write_misses + L2_cache.writebacks + L2_cache.prefetches) : (L1_cache.read_misses + L1_cache.write_misses + L1_cache.writebacks + L1_cache.prefetches);
+   float mr2 = L2_present ? ((float)L2_cache->read_misses / (float)L2_cache->reads) : 0;
+   // The last level counts every memory access it makes: fetches, writebacks, write-throughs and prefetches (in sectors if sectored)
+   // (same as misses + writebacks + prefetches under WBWA, but also right for the other write policies and the write buffer)
+   uint32_t mem_traffic = L2_present ? L2_cache->mem_traffic : L1_cache.mem_traffic;
 
    cout << "===== Measurements =====" << endl;
    cout << left << setw(30) << "a. L1 reads:"                  << dec << L1_cache.reads << endl;
@@ -123,16 +371,41 @@ int main (int argc, char *argv[]) {
    cout << left << setw(30) << "e. L1 miss rate:"              << fixed << setprecision(4) << ((float)L1_cache.read_misses + (float)L1_cache.write_misses) / ((float)L1_cache.reads + (float)L1_cache.writes) << endl;
    cout << left << setw(30) << "f. L1 writebacks:"             << dec << L1_cache.writebacks << endl;
    cout << left << setw(30) << "g. L1 prefetches:"             << dec << L1_cache.prefetches << endl;
-   cout << left << setw(30) << "h. L2 reads (demand):"         << dec << L2_cache.reads << endl;
-   cout << left << setw(30) << "i. L2 read misses (demand):"   << dec << L2_cache.read_misses << endl;
-   cout << left << setw(30) << "j. L2 reads (prefetch):"       << dec << L2_cache.read_prefetch << endl;
-   cout << left << setw(30) << "k. L2 read misses (prefetch):" << dec << L2_cache.read_prefetch_misses << endl;
-   cout << left << setw(30) << "l. L2 writes:"                 << dec << L2_cache.writes << endl;
-   cout << left << setw(30) << "m. L2 write misses:"           << dec << L2_cache.write_misses << endl;
+   cout << left << setw(30) << "h. L2 reads (demand):"         << dec << (L2_present ? L2_cache->reads : 0) << endl;
+   cout << left << setw(30) << "i. L2 read misses (demand):"   << dec << (L2_present ? L2_cache->read_misses : 0) << endl;
+   cout << left << setw(30) << "j. L2 reads (prefetch):"       << dec << (L2_present ? L2_cache->read_prefetch : 0) << endl;
+   cout << left << setw(30) << "k. L2 read misses (prefetch):" << dec << (L2_present ? L2_cache->read_prefetch_misses : 0) << endl;
+   cout << left << setw(30) << "l. L2 writes:"                 << dec << (L2_present ? L2_cache->writes : 0) << endl;
+   cout << left << setw(30) << "m. L2 write misses:"           << dec << (L2_present ? L2_cache->write_misses : 0) << endl;
    cout << left << setw(30) << "n. L2 miss rate:"              << fixed << setprecision(4) << mr2 << endl;
-   cout << left << setw(30) << "o. L2 writebacks:"             << dec << L2_cache.writebacks << endl;
-   cout << left << setw(30) << "p. L2 prefetches:"             << dec << L2_cache.prefetches << endl;
+   cout << left << setw(30) << "o. L2 writebacks:"             << dec << (L2_present ? L2_cache->writebacks : 0) << endl;
+   cout << left << setw(30) << "p. L2 prefetches:"             << dec << (L2_present ? L2_cache->prefetches : 0) << endl;
    cout << left << setw(30) << "q. memory traffic:"            << dec << mem_traffic << endl;
 
+   // Extra measurements for the hierarchy options (only printed when one is in use)
+   if (extended) {
+      cout << left << setw(30) << "L1 victim cache hits:"         << dec << L1_cache.victim_hits << endl;
+      cout << left << setw(30) << "L2 victim cache hits:"         << dec << (L2_present ? L2_cache->victim_hits : 0) << endl;
+      cout << left << setw(30) << "L1 back-invalidations:"        << dec << L1_cache.back_invalidations << endl;
+      cout << left << setw(30) << "L1 write-throughs:"            << dec << L1_cache.write_throughs << endl;
+      cout << left << setw(30) << "L2 write-throughs:"            << dec << (L2_present ? L2_cache->write_throughs : 0) << endl;
+      cout << left << setw(30) << "L1 writes absorbed:"           << dec << L1_cache.writes_absorbed << endl;
+      cout << left << setw(30) << "L2 writes absorbed:"           << dec << (L2_present ? L2_cache->writes_absorbed : 0) << endl;
+      cout << left << setw(30) << "memory traffic (bytes):"       << dec << (uint64_t)mem_traffic * (params.BLOCKSIZE / params.SECTORS) << endl;
+   }
+
+   // Self profile goes last so the regular output above stays unchanged
+   if (profiler != NULL) {
+      profiler->report((uint64_t)L1_cache.reads + L1_cache.writes);
+      L1_cache.profiler = NULL;
+      if (L2_present) {
+         L2_cache->profiler = NULL;
+      }
+      delete profiler;
+   }
+
+   delete miss_stream;
+   delete L2_cache;
+
    return(0);
 }
@@ -5,6 +5,21 @@
 
 // Nothing much to yap about here :(
 
+// Inclusion policy between L1 and L2
+typedef enum {
+   INCLUSION_NINE,         // Non-inclusive non-exclusive (no back-invalidation)
+   INCLUSION_INCLUSIVE,    // L2 evictions back-invalidate L1
+   INCLUSION_EXCLUSIVE     // L2 only holds L1 victims
+} inclusion_t;
+
+// Write hit / write miss policy of a cache
+typedef enum {
+   WRITE_WBWA,             // Write-back, write-allocate
+   WRITE_WT,               // Write-through, write-allocate
+   WRITE_NWA,              // Write-back, no-write-allocate
+   WRITE_AROUND            // Write-through, no-write-allocate
+} write_policy_t;
+
 // Cache
 typedef 
 struct {
@@ -15,17 +30,30 @@ struct {
    uint32_t L2_ASSOC;
    uint32_t PREF_N;
    uint32_t PREF_M;
+   inclusion_t INCLUSION;
+   uint32_t L1_VICTIM;
+   uint32_t L2_VICTIM;
+   write_policy_t L1_WRITE;
+   write_policy_t L2_WRITE;
+   uint32_t L1_WBUF;
+   uint32_t L2_WBUF;
+   uint32_t SECTORS;
 } cache_params_t;
 
-// Cache Block
+// Cache Block (8 bytes; sweeps can hold millions of these, so keep fields at their minimal width)
 typedef struct {
-   bool validBit;
-   bool dirtyBit;
-   uint32_t lru_counter;
    uint32_t tag;
-   uint32_t block_data; // Data value of the block (kind of useless)
+   uint16_t lru_counter; // Age in the set, 0 = MRU (limits associativity and victim entries to 65536)
+   bool validBit : 1;
+   bool dirtyBit : 1;
 } Cache_Block;
 
+// Sector masks of one block, kept in a side array only if the cache is sectored
+typedef struct {
+   uint32_t validSectors; // One bit per sector present
+   uint32_t dirtySectors; // One bit per sector modified (dirtyBit = any set)
+} Sector_Masks;
+
 // Cache Set
 typedef struct {
    Cache_Block *blocks; // Pointer to accesss the array of blocks in the set
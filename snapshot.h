@@ -0,0 +1,76 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define SNAPSHOT_COUNTERS       9       // reads, read_misses, writes, write_misses, writebacks, prefetches, read_prefetch, read_prefetch_misses, mem_traffic
+#define SNAPSHOT_BLOCK_WORDS    4       // lru, valid, dirty, tag
+
+// Observable state of one cache level in a layout that does not depend on how the engine stores it
+// Sets are listed in LRU order (MRU first) and so are the stream buffers, so two engines that behave
+// the same produce the same snapshot even if they place blocks in different ways
+struct Cache_Snapshot {
+    uint32_t assoc = 0;                     // Blocks per set (to locate a difference)
+    uint32_t bufferWords = 0;               // Words per stream buffer entry (lru, valid, then its blocks)
+    vector<uint32_t> counters;              // SNAPSHOT_COUNTERS values
+    vector<uint32_t> blocks;                // SNAPSHOT_BLOCK_WORDS per block
+    vector<uint32_t> buffers;               // bufferWords per stream buffer
+};
+
+// Compares two snapshots; on a difference describes the first one (counter, set/position or buffer) in where
+bool snapshot_equal(const Cache_Snapshot &ref, const Cache_Snapshot &eng, string &where) {
+    const char *counterNames[SNAPSHOT_COUNTERS] = { "reads", "read_misses", "writes", "write_misses", "writebacks",
+                                                    "prefetches", "read_prefetch", "read_prefetch_misses", "mem_traffic" };
+    const char *blockNames[SNAPSHOT_BLOCK_WORDS] = { "lru", "valid", "dirty", "tag" };
+    char text[160];
+
+    if ((ref.assoc != eng.assoc) || (ref.bufferWords != eng.bufferWords)
+        || (ref.blocks.size() != eng.blocks.size()) || (ref.buffers.size() != eng.buffers.size())) {
+        where = "geometry";
+        return false;
+    }
+
+    for (uint32_t i = 0; i < SNAPSHOT_COUNTERS; i++) {
+        if (ref.counters[i] != eng.counters[i]) {
+            snprintf(text, sizeof(text), "%s: ref %u, engine %u", counterNames[i], ref.counters[i], eng.counters[i]);
+            where = text;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < ref.blocks.size(); i++) {
+        if (ref.blocks[i] != eng.blocks[i]) {
+            size_t block = i / SNAPSHOT_BLOCK_WORDS;
+            snprintf(text, sizeof(text), "set %zu, LRU position %zu, %s: ref 0x%x, engine 0x%x", block / ref.assoc, block % ref.assoc,
+                     blockNames[i % SNAPSHOT_BLOCK_WORDS], ref.blocks[i], eng.blocks[i]);
+            where = text;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < ref.buffers.size(); i++) {
+        if (ref.buffers[i] != eng.buffers[i]) {
+            size_t word = i % ref.bufferWords;
+            char field[32];
+            if (word < 2) {
+                snprintf(field, sizeof(field), "%s", (word == 0) ? "lru" : "valid");
+            }
+            else {
+                snprintf(field, sizeof(field), "block %zu", word - 2);
+            }
+            snprintf(text, sizeof(text), "stream buffer at LRU position %zu, %s: ref 0x%x, engine 0x%x", i / ref.bufferWords,
+                     field, ref.buffers[i], eng.buffers[i]);
+            where = text;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#endif